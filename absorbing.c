@@ -0,0 +1,533 @@
+#include "absorbing.h"
+#include <string.h>
+
+#define UNSEEN -2
+#define ABSORBING -1
+// a pivot this small means I - Q is singular: some walks never end
+#define SINGULAR_PIVOT 1e-12
+
+/**
+ * The transient states reachable from the first state of the walks, i.e.
+ * those walks don't end at, by row of Q, and their edges with the
+ * probabilities of taking them: the edges of row r are [first[r],
+ * first[r + 1]). The first state of the walks is row 0.
+ */
+typedef struct Transitions
+{
+    int transient_num;
+    int *ids; // by row
+    int *rows; // by id: the row of a transient state, ABSORBING or UNSEEN
+    int *first;
+    int *targets; // ids of the successors
+    double *probs;
+    bool *jumps; // by row: whether the walk moves on without a step
+} Transitions;
+
+/**
+ * frees the transitions of an absorbing chain
+ * @param transitions transitions to free
+ */
+static void free_transitions (Transitions *transitions)
+{
+  free (transitions->ids);
+  free (transitions->rows);
+  free (transitions->first);
+  free (transitions->targets);
+  free (transitions->probs);
+  free (transitions->jumps);
+}
+
+/**
+ * checks if walks end at a state
+ * @param markov_chain chain of the state
+ * @param markov_node state
+ * @return true if they do, false otherwise
+ */
+static bool is_absorbing (const MarkovChain *markov_chain,
+                          const MarkovNode *markov_node)
+{
+  return markov_node->next_node_ctr == 0 || markov_chain->is_last (
+      markov_node);
+}
+
+/**
+ * finds the states reachable from a state, breadth first, and gives the
+ * transient ones their rows
+ * @param markov_chain chain
+ * @param first_id id of the first state of the walks
+ * @param transitions transitions with ids and rows allocated, rows filled
+ * with UNSEEN
+ * @param counters room for the counters of any state
+ * @return number of edges of the transient states
+ */
+static int find_reachable (const MarkovChain *markov_chain, int first_id,
+                           Transitions *transitions, NextNodeCounter *counters)
+{
+  int *ids = transitions->ids, *rows = transitions->rows;
+  int edge_num = 0;
+  if (is_absorbing (markov_chain, markov_chain->states[first_id]))
+  {
+    rows[first_id] = ABSORBING;
+    return 0;
+  }
+  // the rows found so far are the queue
+  rows[first_id] = 0;
+  ids[transitions->transient_num++] = first_id;
+  for (int row = 0; row < transitions->transient_num; row++)
+  {
+    int num = read_counter_list (markov_chain,
+                                 markov_chain->states[ids[row]], counters);
+    edge_num += num;
+    for (int e = 0; e < num; e++)
+    {
+      int id = counters[e].id;
+      if (rows[id] != UNSEEN)
+      {
+        continue;
+      }
+      if (is_absorbing (markov_chain, markov_chain->states[id]))
+      {
+        rows[id] = ABSORBING;
+        continue;
+      }
+      rows[id] = transitions->transient_num;
+      ids[transitions->transient_num++] = id;
+    }
+  }
+  return edge_num;
+}
+
+/**
+ * builds the transitions of the walks from a state
+ * @param markov_chain chain
+ * @param first_id id of the first state of the walks
+ * @param is_jump tells the states the walk moves on from without a step,
+ * may be NULL
+ * @param transitions filled with the transitions
+ * @return true on success, false on allocation failure
+ */
+static bool build_transitions (const MarkovChain *markov_chain, int first_id,
+                               IsJump is_jump, Transitions *transitions)
+{
+  int state_num = markov_chain->database->size, max_edges = 0;
+  for (int id = 0; id < state_num; id++)
+  {
+    if (markov_chain->states[id]->next_node_ctr > max_edges)
+    {
+      max_edges = markov_chain->states[id]->next_node_ctr;
+    }
+  }
+  NextNodeCounter *counters = malloc ((max_edges + 1)
+                                      * sizeof (NextNodeCounter));
+  transitions->ids = malloc (state_num * sizeof (int));
+  transitions->rows = malloc (state_num * sizeof (int));
+  if (counters == NULL || transitions->ids == NULL
+      || transitions->rows == NULL)
+  {
+    free (counters);
+    return false;
+  }
+  for (int id = 0; id < state_num; id++)
+  {
+    transitions->rows[id] = UNSEEN;
+  }
+  int edge_num = find_reachable (markov_chain, first_id, transitions,
+                                 counters);
+  int transient_num = transitions->transient_num;
+  transitions->first = malloc ((transient_num + 1) * sizeof (int));
+  transitions->targets = malloc ((edge_num + 1) * sizeof (int));
+  transitions->probs = malloc ((edge_num + 1) * sizeof (double));
+  transitions->jumps = malloc ((transient_num + 1) * sizeof (bool));
+  if (transitions->first == NULL || transitions->targets == NULL
+      || transitions->probs == NULL || transitions->jumps == NULL)
+  {
+    free (counters);
+    return false;
+  }
+  int edge = 0;
+  for (int row = 0; row < transient_num; row++)
+  {
+    const MarkovNode *markov_node = markov_chain->states[transitions->ids[row]];
+    transitions->jumps[row] = is_jump != NULL && is_jump (markov_node);
+    transitions->first[row] = edge;
+    int num = read_counter_list (markov_chain, markov_node, counters);
+    long total = 0;
+    for (int e = 0; e < num; e++)
+    {
+      total += counters[e].frequency;
+    }
+    for (int e = 0; e < num; e++, edge++)
+    {
+      transitions->targets[edge] = counters[e].id;
+      transitions->probs[edge] = (double) counters[e].frequency
+                                 / (double) total;
+    }
+  }
+  transitions->first[transient_num] = edge;
+  free (counters);
+  return true;
+}
+
+/**
+ * factors A = I - Q as PA = LU by Gaussian elimination with partial
+ * pivoting: L, unit lower triangular, and U are stored together in lu, and
+ * row i of PA is row perm[i] of A
+ * @param transitions transitions
+ * @param lu filled with L and U, n * n doubles row major, n the number of
+ * transient states
+ * @param perm filled with the row permutation, n ints
+ * @return true on success, false if A is singular
+ */
+static bool factor (const Transitions *transitions, double *lu, int *perm)
+{
+  int n = transitions->transient_num;
+  memset (lu, 0, (size_t) n * n * sizeof (double));
+  for (int row = 0; row < n; row++)
+  {
+    perm[row] = row;
+    lu[(size_t) row * n + row] = 1;
+    for (int e = transitions->first[row]; e < transitions->first[row + 1];
+         e++)
+    {
+      int col = transitions->rows[transitions->targets[e]];
+      if (col >= 0)
+      {
+        lu[(size_t) row * n + col] -= transitions->probs[e];
+      }
+    }
+  }
+  for (int col = 0; col < n; col++)
+  {
+    int pivot = col;
+    for (int row = col + 1; row < n; row++)
+    {
+      double a = lu[(size_t) row * n + col];
+      double b = lu[(size_t) pivot * n + col];
+      if ((a < 0 ? -a : a) > (b < 0 ? -b : b))
+      {
+        pivot = row;
+      }
+    }
+    double value = lu[(size_t) pivot * n + col];
+    if ((value < 0 ? -value : value) < SINGULAR_PIVOT)
+    {
+      return false;
+    }
+    if (pivot != col)
+    {
+      for (int k = 0; k < n; k++)
+      {
+        double temp = lu[(size_t) pivot * n + k];
+        lu[(size_t) pivot * n + k] = lu[(size_t) col * n + k];
+        lu[(size_t) col * n + k] = temp;
+      }
+      int temp = perm[pivot];
+      perm[pivot] = perm[col];
+      perm[col] = temp;
+    }
+    for (int row = col + 1; row < n; row++)
+    {
+      double factor = lu[(size_t) row * n + col] / value;
+      lu[(size_t) row * n + col] = factor;
+      if (factor == 0)
+      {
+        continue;
+      }
+      for (int k = col + 1; k < n; k++)
+      {
+        lu[(size_t) row * n + k] -= factor * lu[(size_t) col * n + k];
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * solves A^T x = e_0 with the factors of A = I - Q: x is row 0 of
+ * N = A^-1, the mean number of visits to each state of a walk from the
+ * first one
+ * @param lu factors of A
+ * @param perm row permutation of the factors
+ * @param n number of transient states
+ * @param work room for n doubles
+ * @param x filled with the solution, n doubles
+ */
+static void solve_first_row (const double *lu, const int *perm, int n,
+                             double *work, double *x)
+{
+  // A^T = U^T L^T P: U^T z = e_0, then L^T w = z, then x = P^T w
+  for (int i = 0; i < n; i++)
+  {
+    double sum = i == 0 ? 1 : 0;
+    for (int k = 0; k < i; k++)
+    {
+      sum -= lu[(size_t) k * n + i] * work[k];
+    }
+    work[i] = sum / lu[(size_t) i * n + i];
+  }
+  for (int i = n - 1; i >= 0; i--)
+  {
+    for (int k = i + 1; k < n; k++)
+    {
+      work[i] -= lu[(size_t) k * n + i] * work[k];
+    }
+  }
+  for (int i = 0; i < n; i++)
+  {
+    x[perm[i]] = work[i];
+  }
+}
+
+/**
+ * solves A y = e_j with the factors of A = I - Q and returns y_j, the
+ * diagonal entry (j, j) of N = A^-1: the mean number of visits to state j
+ * of a walk from j
+ * @param lu factors of A
+ * @param perm row permutation of the factors
+ * @param n number of transient states
+ * @param j row of the state
+ * @param work room for n doubles
+ * @return entry (j, j) of N
+ */
+static double solve_diagonal (const double *lu, const int *perm, int n, int j,
+                              double *work)
+{
+  // L U y = P e_j
+  for (int i = 0; i < n; i++)
+  {
+    double sum = perm[i] == j ? 1 : 0;
+    for (int k = 0; k < i; k++)
+    {
+      sum -= lu[(size_t) i * n + k] * work[k];
+    }
+    work[i] = sum;
+  }
+  for (int i = n - 1; i >= j; i--)
+  {
+    double sum = work[i];
+    for (int k = i + 1; k < n; k++)
+    {
+      sum -= lu[(size_t) i * n + k] * work[k];
+    }
+    work[i] = sum / lu[(size_t) i * n + i];
+  }
+  return work[j];
+}
+
+/**
+ * fills the visits and the mean number of steps of the walks from the
+ * first row of the transitions
+ * @param transitions transitions
+ * @param lu factors of I - Q
+ * @param perm row permutation of the factors
+ * @param work room for 2 * n doubles, n the number of transient states
+ * @param stats statistics with the arrays by id zeroed
+ */
+static void fill_visits (const Transitions *transitions, const double *lu,
+                         const int *perm, double *work, AbsorbingStats *stats)
+{
+  int n = transitions->transient_num;
+  double *visits = work + n;
+  solve_first_row (lu, perm, n, work, visits);
+  stats->expected_steps = 0;
+  for (int row = 0; row < n; row++)
+  {
+    int id = transitions->ids[row];
+    stats->expected_visits[id] = visits[row];
+    // a walk that reaches the state visits it N (row, row) times on average
+    // from there
+    stats->visit_probs[id] = visits[row]
+                             / solve_diagonal (lu, perm, n, row, work);
+    if (transitions->jumps[row] == false)
+    {
+      stats->expected_steps += visits[row];
+    }
+    // each visit leaves through one of the state's edges
+    for (int e = transitions->first[row]; e < transitions->first[row + 1];
+         e++)
+    {
+      int target = transitions->targets[e];
+      if (transitions->rows[target] == ABSORBING)
+      {
+        stats->expected_visits[target] += visits[row] * transitions->probs[e];
+        stats->visit_probs[target] += visits[row] * transitions->probs[e];
+      }
+    }
+  }
+}
+
+/**
+ * moves the probability of being at a state to its successors
+ * @param transitions transitions
+ * @param row row of the state
+ * @param prob probability of being at the state
+ * @param position probabilities of being at each transient state, added to
+ * @param absorbed probability that the walk ended, added to
+ */
+static void spread (const Transitions *transitions, int row, double prob,
+                    double *position, double *absorbed)
+{
+  for (int e = transitions->first[row]; e < transitions->first[row + 1]; e++)
+  {
+    int target = transitions->rows[transitions->targets[e]];
+    if (target >= 0)
+    {
+      position[target] += prob * transitions->probs[e];
+    }
+    else
+    {
+      *absorbed += prob * transitions->probs[e];
+    }
+  }
+}
+
+/**
+ * moves the walk on from the states it doesn't take a step at, within the
+ * same step
+ * @param transitions transitions
+ * @param position probabilities of being at each transient state
+ * @param absorbed probability that the walk ended, added to
+ */
+static void pass_jumps (const Transitions *transitions, double *position,
+                        double *absorbed)
+{
+  int n = transitions->transient_num;
+  // a jump may lead to another one, but not around for ever, or I - Q would
+  // have been singular
+  bool moved = true;
+  for (int pass = 0; moved && pass < n; pass++)
+  {
+    moved = false;
+    for (int row = 0; row < n; row++)
+    {
+      if (transitions->jumps[row] && position[row] != 0)
+      {
+        double prob = position[row];
+        position[row] = 0;
+        spread (transitions, row, prob, position, absorbed);
+        moved = true;
+      }
+    }
+  }
+}
+
+/**
+ * fills the distribution of the number of steps of the walks from the
+ * first row of the transitions
+ * @param transitions transitions
+ * @param position room for 2 * n doubles, n the number of transient states
+ * @param stats statistics with length_probs zeroed
+ */
+static void fill_lengths (const Transitions *transitions, double *position,
+                          AbsorbingStats *stats)
+{
+  int n = transitions->transient_num;
+  double *cur = position, *next = position + n;
+  memset (cur, 0, n * sizeof (double));
+  cur[0] = 1;
+  pass_jumps (transitions, cur, &stats->length_probs[0]);
+  for (int t = 1; t <= stats->max_length; t++)
+  {
+    memset (next, 0, n * sizeof (double));
+    for (int row = 0; row < n; row++)
+    {
+      if (cur[row] != 0)
+      {
+        spread (transitions, row, cur[row], next, &stats->length_probs[t]);
+      }
+    }
+    pass_jumps (transitions, next, &stats->length_probs[t]);
+    double *temp = cur;
+    cur = next;
+    next = temp;
+  }
+  stats->unfinished = 0;
+  for (int row = 0; row < n; row++)
+  {
+    stats->unfinished += cur[row];
+  }
+}
+
+AbsorbingStats *solve_absorbing_chain (const MarkovChain *markov_chain,
+                                       const MarkovNode *first_node,
+                                       IsJump is_jump, int max_length)
+{
+  int state_num = markov_chain->database->size;
+  // the walks are solved by id, so first_node must be the chain's own state
+  if (first_node == NULL || first_node->id < 0 || first_node->id >= state_num
+      || markov_chain->states[first_node->id] != first_node)
+  {
+    return NULL;
+  }
+  AbsorbingStats *stats = calloc (1, sizeof (AbsorbingStats));
+  if (stats == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return NULL;
+  }
+  stats->state_num = state_num;
+  stats->max_length = max_length;
+  stats->length_probs = calloc (max_length + 1, sizeof (double));
+  stats->visit_probs = calloc (state_num + 1, sizeof (double));
+  stats->expected_visits = calloc (state_num + 1, sizeof (double));
+  Transitions transitions = {0, NULL, NULL, NULL, NULL, NULL, NULL};
+  if (stats->length_probs == NULL || stats->visit_probs == NULL
+      || stats->expected_visits == NULL
+      || build_transitions (markov_chain, first_node->id, is_jump,
+                            &transitions) == false)
+  {
+    free_transitions (&transitions);
+    free_absorbing_stats (&stats);
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return NULL;
+  }
+  size_t n = transitions.transient_num;
+  if (n == 0)
+  {
+    // walks end where they start
+    stats->length_probs[0] = 1;
+    stats->visit_probs[first_node->id] = 1;
+    stats->expected_visits[first_node->id] = 1;
+    free_transitions (&transitions);
+    return stats;
+  }
+  double *lu = malloc (n * n * sizeof (double));
+  int *perm = malloc (n * sizeof (int));
+  double *work = malloc (2 * n * sizeof (double));
+  bool suc = lu != NULL && perm != NULL && work != NULL;
+  if (suc == false)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+  }
+  else if (factor (&transitions, lu, perm))
+  {
+    fill_visits (&transitions, lu, perm, work, stats);
+    fill_lengths (&transitions, work, stats);
+  }
+  else
+  {
+    suc = false;
+  }
+  free (lu);
+  free (perm);
+  free (work);
+  free_transitions (&transitions);
+  if (suc == false)
+  {
+    free_absorbing_stats (&stats);
+  }
+  return stats;
+}
+
+void free_absorbing_stats (AbsorbingStats **stats)
+{
+  if (*stats == NULL)
+  {
+    return;
+  }
+  free ((*stats)->length_probs);
+  free ((*stats)->visit_probs);
+  free ((*stats)->expected_visits);
+  free (*stats);
+  *stats = NULL;
+}
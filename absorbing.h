@@ -0,0 +1,70 @@
+#ifndef _ABSORBING_H_
+#define _ABSORBING_H_
+#include "markov_chain.h"
+
+/**
+ * Exact statistics of the walks of a chain from one state, as an absorbing
+ * Markov chain: the walk goes from state to state with the probabilities
+ * of the edges' frequencies, and ends at the first last state (see is_last)
+ * or state with no successors it reaches, like generate_sequence with no
+ * maximal length. A step is a move from a state to the next, except from a
+ * jump state, which the walk moves on from within the step that got it
+ * there, like a player climbing a ladder within the turn that got them to
+ * its foot: on a game board, a step is a turn.
+ */
+typedef struct AbsorbingStats
+{
+    int state_num; // size of the arrays by id
+    double expected_steps; // mean number of steps of a walk
+    // probability that a walk takes exactly t steps, for t in
+    // [0, max_length]
+    double *length_probs;
+    int max_length;
+    double unfinished; // probability that a walk takes more steps
+    // by id, the probability that a walk reaches the state, and the mean
+    // number of times it does (the start counts as a visit). For a state
+    // walks end at, both are the probability that they end there.
+    double *visit_probs;
+    double *expected_visits;
+} AbsorbingStats;
+
+/**
+ * Tells whether a walk moves on from a state without a step. Gets the
+ * state's MarkovNode, like IsLast.
+ */
+typedef bool (*IsJump) (const void *);
+
+/**
+ * Solves the absorbing chain of the states reachable from a given one: the
+ * transition matrix Q between the reachable states walks don't end at is
+ * built from the frequencies of their edges, and I - Q is factored by
+ * Gaussian elimination. Row 0 of its inverse N, the mean number of visits
+ * to each state of a walk from the first one, is solved from the transposed
+ * system (I - Q)^T x = e_0; the probability of visiting a state also needs
+ * the diagonal entry of N for it, one solve with the same factors each.
+ * This takes time cubic and memory quadratic in the number of those states,
+ * so it suits chains the size of a game board, not of a corpus. The
+ * distribution of the number of steps is computed by pushing the
+ * distribution of the walk's position through the edges one step at a
+ * time. The chain may be frozen or compacted, and isn't modified.
+ * @param markov_chain chain
+ * @param first_node state the walks start from. A walk from a state walks
+ * end at takes no steps.
+ * @param is_jump tells the jump states, NULL if there are none
+ * @param max_length number of steps the distribution of the number of
+ * steps goes up to, at least 0
+ * @return the statistics, to be freed with free_absorbing_stats, NULL in
+ * case of allocation error, if some walks never end or if first_node isn't
+ * a state of the chain
+ */
+AbsorbingStats *solve_absorbing_chain (const MarkovChain *markov_chain,
+                                       const MarkovNode *first_node,
+                                       IsJump is_jump, int max_length);
+
+/**
+ * Frees the statistics of an absorbing chain.
+ * @param stats statistics to free, set to NULL
+ */
+void free_absorbing_stats (AbsorbingStats **stats);
+
+#endif //_ABSORBING_H_
@@ -0,0 +1,80 @@
+#include "arena.h"
+
+#define ARENA_ALIGN sizeof (void *)
+
+Arena *new_arena (void)
+{
+  Arena *arena = malloc (sizeof (Arena));
+  if (arena == NULL)
+  {
+    return NULL;
+  }
+  arena->head = NULL;
+  return arena;
+}
+
+/**
+ * allocates a new block and links it to the arena's block list
+ * @param arena arena to add the block to
+ * @param size minimal number of free bytes in the block
+ * @return the new block, NULL on allocation failure
+ */
+static ArenaBlock *add_block (Arena *arena, size_t size)
+{
+  if (size < ARENA_BLOCK_SIZE)
+  {
+    size = ARENA_BLOCK_SIZE;
+  }
+  ArenaBlock *block = malloc (sizeof (ArenaBlock) + size);
+  if (block == NULL)
+  {
+    return NULL;
+  }
+  block->used = 0;
+  block->size = size;
+  if (arena->head != NULL && size > ARENA_BLOCK_SIZE)
+  {
+    // an oversized block is full right away, keep allocating from the head
+    block->next = arena->head->next;
+    arena->head->next = block;
+  }
+  else
+  {
+    block->next = arena->head;
+    arena->head = block;
+  }
+  return block;
+}
+
+void *arena_alloc (Arena *arena, size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  ArenaBlock *block = arena->head;
+  if (block == NULL || block->size - block->used < size)
+  {
+    block = add_block (arena, size);
+    if (block == NULL)
+    {
+      return NULL;
+    }
+  }
+  void *ret = block->bytes + block->used;
+  block->used += size;
+  return ret;
+}
+
+void free_arena (Arena *arena)
+{
+  if (arena == NULL)
+  {
+    return;
+  }
+  ArenaBlock *cur = arena->head;
+  while (cur != NULL)
+  {
+    ArenaBlock *temp = cur->next;
+    free (cur);
+    cur = temp;
+  }
+  free (arena);
+}
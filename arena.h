@@ -0,0 +1,43 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+#include <stdlib.h> // For malloc()
+
+#define ARENA_BLOCK_SIZE 65536
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char bytes[];
+} ArenaBlock;
+
+/**
+ * Bump allocator: allocations are carved back to back out of large blocks
+ * and can only be released all together.
+ */
+typedef struct Arena {
+    ArenaBlock *head; // block currently allocated from
+} Arena;
+
+/**
+ * Allocates an empty arena.
+ * @return pointer to the new arena, NULL on allocation failure
+ */
+Arena *new_arena (void);
+
+/**
+ * Allocates size bytes from the arena, aligned to the size of a pointer.
+ * Requests bigger than ARENA_BLOCK_SIZE get a block of their own.
+ * @param arena arena to allocate from
+ * @param size number of bytes
+ * @return pointer to the allocated bytes, NULL on allocation failure
+ */
+void *arena_alloc (Arena *arena, size_t size);
+
+/**
+ * Frees the arena and every allocation made from it.
+ * @param arena arena to free
+ */
+void free_arena (Arena *arena);
+
+#endif //_ARENA_H_
@@ -0,0 +1,204 @@
+#include "board.h"
+
+#define MAX(X, Y) (((X) < (Y)) ? (Y) : (X))
+
+#define DICE_MAX 6
+#define NUM_OF_TRANSITIONS 20
+
+/**
+ * represents the transitions by ladders and snakes in the game
+ * each tuple (x,y) represents a ladder from x to if x<y or a snake otherwise
+ */
+const int transitions[][2] = {{13, 4},
+                              {85, 17},
+                              {95, 67},
+                              {97, 58},
+                              {66, 89},
+                              {87, 31},
+                              {57, 83},
+                              {91, 25},
+                              {28, 50},
+                              {35, 11},
+                              {8,  30},
+                              {41, 62},
+                              {81, 43},
+                              {69, 32},
+                              {20, 39},
+                              {33, 70},
+                              {79, 99},
+                              {23, 76},
+                              {15, 47},
+                              {61, 14}};
+
+/**
+ * allocates the cells of the board, with their snakes and ladders
+ * @param cells filled with the cells
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int create_board (Cell *cells[BOARD_SIZE])
+{
+  for (int i = 0; i < BOARD_SIZE; i++)
+  {
+    cells[i] = malloc (sizeof (Cell));
+    if (cells[i] == NULL)
+    {
+      for (int j = 0; j < i; j++)
+      {
+        free (cells[j]);
+      }
+      printf (ALLOCATION_ERROR_MASSAGE);
+      return EXIT_FAILURE;
+    }
+    *(cells[i]) = (Cell) {i + 1, EMPTY, EMPTY};
+  }
+
+  for (int i = 0; i < NUM_OF_TRANSITIONS; i++)
+  {
+    int from = transitions[i][0];
+    int to = transitions[i][1];
+    if (from < to)
+    {
+      cells[from - 1]->ladder_to = to;
+    }
+    else
+    {
+      cells[from - 1]->snake_to = to;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+int fill_board_database (MarkovChain *markov_chain)
+{
+  Cell *cells[BOARD_SIZE];
+  if (create_board (cells) == EXIT_FAILURE)
+  {
+    return EXIT_FAILURE;
+  }
+  MarkovNode *from_node = NULL, *to_node = NULL;
+  size_t index_to;
+  for (size_t i = 0; i < BOARD_SIZE; i++)
+  {
+    add_to_database (markov_chain, cells[i]);
+  }
+
+  for (size_t i = 0; i < BOARD_SIZE; i++)
+  {
+    from_node = get_node_from_database (markov_chain, cells[i])->data;
+
+    if (cells[i]->snake_to != EMPTY || cells[i]->ladder_to != EMPTY)
+    {
+      index_to = MAX(cells[i]->snake_to, cells[i]->ladder_to) - 1;
+      to_node = get_node_from_database (markov_chain, cells[index_to])
+          ->data;
+      add_node_to_counter_list (from_node, to_node, markov_chain);
+    }
+    else
+    {
+      for (int j = 1; j <= DICE_MAX; j++)
+      {
+        index_to = ((Cell *) (from_node->data))->number + j - 1;
+        if (index_to >= BOARD_SIZE)
+        {
+          break;
+        }
+        to_node = get_node_from_database (markov_chain, cells[index_to])
+            ->data;
+        add_node_to_counter_list (from_node, to_node, markov_chain);
+      }
+    }
+  }
+  // free temp arr
+  for (size_t i = 0; i < BOARD_SIZE; i++)
+  {
+    free (cells[i]);
+  }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * copies a cell type and returns the copy
+ * @param cell_p cell to be copied
+ * @return copied cell
+ */
+static void *copy_cell (const void *cell_p)
+{
+  Cell *old_cell = (Cell *) cell_p;
+  Cell *cell = malloc (sizeof (Cell));
+  if (cell == NULL)
+  {
+    return NULL;
+  }
+  cell->ladder_to = old_cell->ladder_to;
+  cell->snake_to = old_cell->snake_to;
+  cell->number = old_cell->number;
+  return cell;
+}
+
+/**
+ * compares the number in given cells
+ * @param a first cell
+ * @param b second cell
+ * @return the difference in number betweed cell 1 and 2
+ */
+static int cell_cmp (const void *a, const void *b)
+{
+  Cell *cell1 = (Cell *) a;
+  Cell *cell2 = (Cell *) b;
+  return cell1->number - cell2->number;
+}
+
+/**
+ * hashes a cell by its number
+ * @param cell_p pointer to the cell
+ * @return hash of the cell
+ */
+static unsigned long cell_hash (const void *cell_p)
+{
+  return (unsigned long) ((Cell *) cell_p)->number;
+}
+
+static MARKOV_DEFINE_LOOKUP (cell_lookup, cell_hash, cell_cmp)
+
+/**
+ * checks if given cell is last in the list
+ * @param cell_p pointer to a cell
+ * @return true if last cell, false otherwise
+ */
+static bool is_last_cell (const void *cell_p)
+{
+  MarkovNode *node = (MarkovNode *) cell_p;
+  Cell *cell = node->data;
+  if (cell->number == BOARD_SIZE || node->is_last)
+  {
+    return true;
+  }
+  return false;
+}
+
+bool is_jump_cell (const void *cell_p)
+{
+  const Cell *cell = ((const MarkovNode *) cell_p)->data;
+  return cell->snake_to != EMPTY || cell->ladder_to != EMPTY;
+}
+
+/**
+ * frees given cell
+ * @param cell_p pointer to cell
+ */
+static void cell_free (void *cell_p)
+{
+  MarkovNode *node = (MarkovNode *) cell_p;
+  Cell *cell = node->data;
+  free (cell);
+}
+
+void set_board_chain (MarkovChain *chain)
+{
+  chain->copy_func = copy_cell;
+  chain->comp_func = cell_cmp;
+  chain->is_last = is_last_cell;
+  chain->free_data = cell_free;
+  chain->hash_func = cell_hash;
+  chain->lookup_func = cell_lookup;
+}
@@ -0,0 +1,45 @@
+#ifndef _BOARD_H_
+#define _BOARD_H_
+#include "markov_chain.h"
+
+#define EMPTY -1
+#define BOARD_SIZE 100
+
+/**
+ * struct represents a Cell in the game board
+ */
+typedef struct Cell
+{
+    int number; // Cell number 1-100
+    int ladder_to;  // ladder_to represents the jump of the ladder in case
+    // there is one from this square
+    int snake_to;  // snake_to represents the jump of the snake in case
+    // there is one from this square
+    //both ladder_to and snake_to should be -1 if the Cell doesn't have them
+} Cell;
+
+/**
+ * Fills the chain with the functions of a chain of cells, except for
+ * print_func, which is left to the caller.
+ * @param chain markov_chain
+ */
+void set_board_chain (MarkovChain *chain);
+
+/**
+ * Checks if a cell has a snake or a ladder, which the player takes within
+ * the turn that got them to the cell (see IsJump in absorbing.h).
+ * @param cell_p MarkovNode of the cell
+ * @return true if it has one, false otherwise
+ */
+bool is_jump_cell (const void *cell_p);
+
+/**
+ * Fills the database with the cells of the snakes and ladders board: a
+ * cell with a snake or a ladder leads to where it goes, any other cell to
+ * each of the next DICE_MAX cells.
+ * @param markov_chain empty chain set with set_board_chain
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int fill_board_database (MarkovChain *markov_chain);
+
+#endif //_BOARD_H_
@@ -0,0 +1,897 @@
+#define _DEFAULT_SOURCE // For fileno(), mmap(), MAP_ANONYMOUS
+#include "corpus.h"
+#include "stats.h"
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h> // For malloc()
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h> // For sysconf()
+
+#define READ_CHUNK 65536
+#define TOKENS_INIT 1024
+
+typedef struct Shard
+{
+    char *begin;
+    char *end;
+    int words_to_read; // -1 for all the words in the range
+    int word_num; // number of words in the range, set by count_words and
+    // train_words
+    const MarkovChain *model; // chain to take the callbacks from
+    MarkovChain *partial;
+    MarkovNode *first; // first and last words of the range in partial
+    MarkovNode *last;
+    int status;
+    uint32_t *tokens; // token ids of the words, for n-gram training
+    size_t token_num;
+    int order; // order of the n-grams to train on tokens
+    int flags; // TOKEN_ flags of next_token
+} Shard;
+
+/**
+ * The bytes of a corpus, either mapped from its file or read into memory.
+ * bytes[size] can always be read and is '\0': a mapping is followed by at
+ * least one page of zeros, a buffer is null terminated. The bytes are
+ * writable, a mapping being private, so words may be lowercased in place.
+ */
+typedef struct Corpus
+{
+    char *bytes;
+    size_t size;
+    size_t map_size; // 0 if bytes were read into memory
+} Corpus;
+
+size_t word_length (const char *word)
+{
+  const char *cur = word;
+  while (is_token_delim (*cur) == false)
+  {
+    cur++;
+  }
+  return cur - word;
+}
+
+int word_cmp (const char *a, const char *b)
+{
+  while (is_token_delim (*a) == false && *a == *b)
+  {
+    a++;
+    b++;
+  }
+  unsigned char c1 = is_token_delim (*a) ? '\0' : *a;
+  unsigned char c2 = is_token_delim (*b) ? '\0' : *b;
+  return c1 - c2;
+}
+
+/**
+ * Maps a regular file into memory, copy on write, over a zeroed region one
+ * page longer, so that the byte after the file reads as '\0' even when the
+ * file fills its last page. Faults its pages in if the phases are timed.
+ * Fails for anything that can't be mapped (pipes, terminals, empty files).
+ * @param fp file to map
+ * @param corpus set to the mapped bytes on success
+ * @return true on success, false otherwise
+ */
+static bool map_corpus (FILE *fp, Corpus *corpus)
+{
+  struct stat st;
+  if (fstat (fileno (fp), &st) != 0 || S_ISREG (st.st_mode) == false
+      || st.st_size == 0)
+  {
+    return false;
+  }
+  size_t size = st.st_size, page = sysconf (_SC_PAGESIZE);
+  size_t map_size = size + page;
+  char *bytes = mmap (NULL, map_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bytes == MAP_FAILED)
+  {
+    return false;
+  }
+  if (mmap (bytes, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+            fileno (fp), 0) == MAP_FAILED)
+  {
+    munmap (bytes, map_size);
+    return false;
+  }
+  posix_madvise (bytes, size, POSIX_MADV_SEQUENTIAL);
+  if (stats_enabled ())
+  {
+    // when timed, the file is read in here rather than on the first touch
+    // of every page while training, so that reading it counts as ingest
+    volatile char sink = 0;
+    for (size_t i = 0; i < size; i += page)
+    {
+      sink += bytes[i];
+    }
+  }
+  *corpus = (Corpus) {bytes, size, map_size};
+  return true;
+}
+
+/**
+ * reads the whole file into a null terminated buffer
+ * @param fp file to read
+ * @param corpus set to the read bytes on success
+ * @return true on success, false on allocation or read failure
+ */
+static bool read_corpus (FILE *fp, Corpus *corpus)
+{
+  size_t capacity = READ_CHUNK, used = 0;
+  char *buf = malloc (capacity + 1);
+  while (buf != NULL)
+  {
+    used += fread (buf + used, 1, capacity - used, fp);
+    if (used < capacity)
+    {
+      break;
+    }
+    capacity *= 2;
+    char *temp = realloc (buf, capacity + 1);
+    if (temp == NULL)
+    {
+      free (buf);
+      return false;
+    }
+    buf = temp;
+  }
+  if (buf == NULL || ferror (fp))
+  {
+    free (buf);
+    return false;
+  }
+  buf[used] = '\0';
+  *corpus = (Corpus) {buf, used, 0};
+  return true;
+}
+
+/**
+ * releases the bytes of a corpus
+ * @param corpus mapped or read corpus
+ */
+static void close_corpus (Corpus *corpus)
+{
+  if (corpus->map_size > 0)
+  {
+    munmap (corpus->bytes, corpus->map_size);
+  }
+  else
+  {
+    free (corpus->bytes);
+  }
+}
+
+/**
+ * allocates an empty chain with the callbacks of model
+ * @param model chain to take the callbacks from
+ * @return the chain, NULL on allocation failure
+ */
+static MarkovChain *new_partial_chain (const MarkovChain *model)
+{
+  MarkovChain *chain = calloc (1, sizeof (MarkovChain));
+  if (chain == NULL)
+  {
+    return NULL;
+  }
+  chain->database = calloc (1, sizeof (LinkedList));
+  if (chain->database == NULL)
+  {
+    free (chain);
+    return NULL;
+  }
+  chain->print_func = model->print_func;
+  chain->comp_func = model->comp_func;
+  chain->free_data = model->free_data;
+  chain->copy_func = model->copy_func;
+  chain->is_last = model->is_last;
+  chain->hash_func = model->hash_func;
+  chain->lookup_func = model->lookup_func;
+  chain->data_size = model->data_size;
+  chain->prune_below = model->prune_below;
+  chain->prune_interval = model->prune_interval;
+  return chain;
+}
+
+/**
+ * thread routine: counts the words in a shard
+ * @param arg the shard
+ * @return NULL
+ */
+static void *count_words (void *arg)
+{
+  Shard *shard = arg;
+  char *pos = shard->begin;
+  shard->word_num = 0;
+  while (next_token (&pos, shard->end, shard->flags) != NULL)
+  {
+    shard->word_num++;
+  }
+  return NULL;
+}
+
+/**
+ * Adds the words of a shard to a chain, each followed by the next. Words
+ * are views into the shard's bytes, so only the ones that become new
+ * states are copied.
+ * @param markov_chain chain to add the words to
+ * @param shard shard to read, continues from its last word if it has one
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int train_words (MarkovChain *markov_chain, Shard *shard)
+{
+  char *pos = shard->begin;
+  shard->word_num = 0;
+  while (shard->word_num != shard->words_to_read)
+  {
+    char *word = next_token (&pos, shard->end, shard->flags);
+    if (word == NULL)
+    {
+      break;
+    }
+    Node *new = add_to_database (markov_chain, (void *) word);
+    if (new == NULL)
+    {
+      return EXIT_FAILURE;
+    }
+    if (shard->last != NULL && add_node_to_counter_list (
+        shard->last, new->data, markov_chain) == false)
+    {
+      return EXIT_FAILURE;
+    }
+    if (shard->first == NULL)
+    {
+      shard->first = new->data;
+    }
+    shard->last = new->data;
+    shard->word_num++;
+  }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * thread routine: builds the partial chain of a shard
+ * @param arg the shard
+ * @return NULL
+ */
+static void *train_shard (void *arg)
+{
+  Shard *shard = arg;
+  shard->status = EXIT_FAILURE;
+  shard->partial = new_partial_chain (shard->model);
+  if (shard->partial != NULL)
+  {
+    shard->status = train_words (shard->partial, shard);
+  }
+  return NULL;
+}
+
+/**
+ * runs routine on every shard, each in its own thread
+ * @param shards shards to process
+ * @param thread_num number of shards
+ * @param routine thread routine
+ * @return EXIT_SUCCESS or EXIT_FAILURE if a thread couldn't be created
+ */
+static int run_threads (Shard *shards, int thread_num,
+                        void *(*routine) (void *))
+{
+  pthread_t threads[MAX_THREADS];
+  int created = 0;
+  for (; created < thread_num; created++)
+  {
+    if (pthread_create (&threads[created], NULL, routine, &shards[created])
+        != 0)
+    {
+      break;
+    }
+  }
+  for (int i = 0; i < created; i++)
+  {
+    pthread_join (threads[i], NULL);
+  }
+  return created == thread_num ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Adds the states and edges of a shard's partial chain to the chain, in the
+ * order they were first seen, after the transition into the shard's first
+ * word.
+ * @param markov_chain chain to merge into
+ * @param shard trained shard
+ * @param prev last word merged so far, updated to the shard's last word
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int merge_shard (MarkovChain *markov_chain, const Shard *shard,
+                        MarkovNode **prev)
+{
+  LinkedList *database = shard->partial->database;
+  if (database->size == 0)
+  {
+    return EXIT_SUCCESS;
+  }
+  MarkovNode **merged = malloc (database->size * sizeof (MarkovNode *));
+  if (merged == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  for (Node *cur = database->first; cur != NULL; cur = cur->next)
+  {
+    Node *new = add_to_database (markov_chain, cur->data->data);
+    if (new == NULL)
+    {
+      free (merged);
+      return EXIT_FAILURE;
+    }
+    merged[cur->data->id] = new->data;
+  }
+  if (*prev != NULL && add_node_to_counter_list (
+      *prev, merged[shard->first->id], markov_chain) == false)
+  {
+    free (merged);
+    return EXIT_FAILURE;
+  }
+  for (Node *cur = database->first; cur != NULL; cur = cur->next)
+  {
+    MarkovNode *from = merged[cur->data->id];
+    for (int i = 0; i < cur->data->next_node_ctr; i++)
+    {
+      NextNodeCounter *counter = &cur->data->counter_list[i];
+      if (add_frequency_to_counter_list (
+          from, merged[counter->id], counter->frequency,
+          markov_chain) == false)
+      {
+        free (merged);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  *prev = merged[shard->last->id];
+  free (merged);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * splits the corpus into thread_num ranges that start at word boundaries
+ * @param shards shards to fill
+ * @param thread_num number of shards
+ * @param corpus corpus to split
+ * @param model chain to take the callbacks from
+ * @param token_flags TOKEN_ flags to read the words with
+ */
+static void split (Shard *shards, int thread_num, const Corpus *corpus,
+                   const MarkovChain *model, int token_flags)
+{
+  char *buf = corpus->bytes;
+  size_t size = corpus->size, begin = 0;
+  for (int i = 0; i < thread_num; i++)
+  {
+    size_t end = i == thread_num - 1 ? size : size / thread_num * (i + 1);
+    if (end < begin)
+    {
+      end = begin;
+    }
+    while (end < size && end > 0 && is_token_delim (buf[end - 1]) == false)
+    {
+      end++;
+    }
+    shards[i] = (Shard) {buf + begin, buf + end, -1, 0, model, NULL, NULL,
+                         NULL, EXIT_FAILURE, NULL, 0, 1, token_flags};
+    begin = end;
+  }
+}
+
+/**
+ * splits words_to_read between the shards, the first words of the corpus
+ * going to the first shards
+ * @param shards split corpus
+ * @param thread_num number of shards
+ * @param words_to_read number of words to read, -1 to read them all
+ * @return EXIT_SUCCESS or EXIT_FAILURE if a thread couldn't be created
+ */
+static int limit_words (Shard *shards, int thread_num, int words_to_read)
+{
+  if (words_to_read < 0)
+  {
+    return EXIT_SUCCESS;
+  }
+  int ret = run_threads (shards, thread_num, count_words);
+  for (int i = 0; i < thread_num; i++)
+  {
+    int n = shards[i].word_num < words_to_read ? shards[i].word_num
+                                               : words_to_read;
+    shards[i].words_to_read = n;
+    words_to_read -= n;
+  }
+  return ret;
+}
+
+/**
+ * trains the chain on a corpus in memory with thread_num threads, see
+ * train_on_file
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int train_sharded (const Corpus *corpus, int words_to_read,
+                          int thread_num, int token_flags,
+                          MarkovChain *markov_chain)
+{
+  Shard *shards = malloc (thread_num * sizeof (Shard));
+  if (shards == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  split (shards, thread_num, corpus, markov_chain, token_flags);
+  int ret = limit_words (shards, thread_num, words_to_read);
+  if (ret == EXIT_SUCCESS)
+  {
+    ret = run_threads (shards, thread_num, train_shard);
+  }
+  MarkovNode *prev = markov_chain->last_state;
+  for (int i = 0; i < thread_num; i++)
+  {
+    if (ret == EXIT_SUCCESS && shards[i].status == EXIT_SUCCESS)
+    {
+      ret = merge_shard (markov_chain, &shards[i], &prev);
+    }
+    else
+    {
+      ret = EXIT_FAILURE;
+    }
+    if (shards[i].partial != NULL)
+    {
+      free_markov_chain (&shards[i].partial);
+    }
+  }
+  markov_chain->last_state = prev;
+  free (shards);
+  return ret;
+}
+
+/**
+ * Trains the chain on a file that can't be mapped by reading it in chunks.
+ * The words cut at the end of a chunk are moved to the start of the buffer
+ * before reading the next one, and the buffer grows to fit longer words.
+ * Reading and training are timed as ingest and training chunk by chunk.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int train_stream (FILE *fp, int words_to_read, int token_flags,
+                         MarkovChain *markov_chain)
+{
+  size_t capacity = READ_CHUNK, used = 0;
+  char *buf = malloc (capacity + 1);
+  if (buf == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  Shard shard = {buf, buf, words_to_read, 0, markov_chain, markov_chain, NULL,
+                 markov_chain->last_state, EXIT_SUCCESS, NULL, 0, 1,
+                 token_flags};
+  while (shard.words_to_read != 0 && shard.status == EXIT_SUCCESS)
+  {
+    stats_begin ("ingest");
+    used += fread (buf + used, 1, capacity - used, fp);
+    stats_end ();
+    bool eof = feof (fp) || ferror (fp);
+    buf[used] = '\0';
+    size_t complete = used;
+    while (eof == false && complete > 0
+           && is_token_delim (buf[complete - 1]) == false)
+    {
+      complete--;
+    }
+    if (complete == 0 && eof == false)
+    {
+      // a single word fills the buffer
+      char *temp = realloc (buf, capacity * 2 + 1);
+      if (temp == NULL)
+      {
+        printf (ALLOCATION_ERROR_MASSAGE);
+        shard.status = EXIT_FAILURE;
+        break;
+      }
+      buf = temp;
+      capacity *= 2;
+      continue;
+    }
+    shard.begin = buf;
+    shard.end = buf + complete;
+    stats_begin ("training");
+    shard.status = train_words (markov_chain, &shard);
+    stats_end ();
+    if (shard.words_to_read > 0)
+    {
+      shard.words_to_read -= shard.word_num;
+    }
+    memmove (buf, buf + complete, used - complete);
+    used -= complete;
+    if (eof)
+    {
+      break;
+    }
+  }
+  free (buf);
+  markov_chain->last_state = shard.last;
+  return shard.status;
+}
+
+int train_on_file (FILE *fp, int words_to_read, int thread_num,
+                   int token_flags, MarkovChain *markov_chain)
+{
+  Corpus corpus;
+  stats_begin ("ingest");
+  bool mapped = map_corpus (fp, &corpus);
+  stats_end ();
+  if (mapped == false)
+  {
+    if (thread_num == 1)
+    {
+      return train_stream (fp, words_to_read, token_flags, markov_chain);
+    }
+    stats_begin ("ingest");
+    bool suc = read_corpus (fp, &corpus);
+    stats_end ();
+    if (suc == false)
+    {
+      printf (ALLOCATION_ERROR_MASSAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  stats_begin ("training");
+  int ret = EXIT_FAILURE;
+  if (thread_num == 1)
+  {
+    Shard shard = {corpus.bytes, corpus.bytes + corpus.size, words_to_read, 0,
+                   markov_chain, markov_chain, NULL, markov_chain->last_state,
+                   EXIT_SUCCESS, NULL, 0, 1, token_flags};
+    ret = train_words (markov_chain, &shard);
+    markov_chain->last_state = shard.last;
+  }
+  else
+  {
+    ret = train_sharded (&corpus, words_to_read, thread_num, token_flags,
+                         markov_chain);
+  }
+  stats_end ();
+  close_corpus (&corpus);
+  return ret;
+}
+
+/**
+ * Adds the words of a shard to a chain of words and appends their ids to
+ * the shard's tokens.
+ * @param vocab chain of words
+ * @param shard shard to read
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int tokenize_words (MarkovChain *vocab, Shard *shard)
+{
+  char *pos = shard->begin;
+  size_t capacity = shard->token_num;
+  shard->word_num = 0;
+  while (shard->word_num != shard->words_to_read)
+  {
+    char *word = next_token (&pos, shard->end, shard->flags);
+    if (word == NULL)
+    {
+      break;
+    }
+    Node *new = add_to_database (vocab, (void *) word);
+    if (new == NULL)
+    {
+      return EXIT_FAILURE;
+    }
+    if (shard->token_num == capacity)
+    {
+      capacity = capacity == 0 ? TOKENS_INIT : capacity * 2;
+      uint32_t *temp = realloc (shard->tokens, capacity * sizeof (uint32_t));
+      if (temp == NULL)
+      {
+        printf (ALLOCATION_ERROR_MASSAGE);
+        return EXIT_FAILURE;
+      }
+      shard->tokens = temp;
+    }
+    shard->tokens[shard->token_num++] = (uint32_t) new->data->id;
+    shard->word_num++;
+  }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * thread routine: reads the words of a shard into a partial vocabulary
+ * @param arg the shard
+ * @return NULL
+ */
+static void *tokenize_shard (void *arg)
+{
+  Shard *shard = arg;
+  shard->status = EXIT_FAILURE;
+  shard->partial = new_partial_chain (shard->model);
+  if (shard->partial != NULL)
+  {
+    shard->status = tokenize_words (shard->partial, shard);
+  }
+  return NULL;
+}
+
+/**
+ * Adds the words of a shard's partial vocabulary to the vocabulary, in the
+ * order they were first seen, and rewrites the shard's tokens with the ids
+ * of the words in the vocabulary.
+ * @param vocab vocabulary to merge into
+ * @param shard tokenized shard
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int merge_tokens (MarkovChain *vocab, Shard *shard)
+{
+  LinkedList *database = shard->partial->database;
+  uint32_t *merged = malloc ((database->size + 1) * sizeof (uint32_t));
+  if (merged == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  for (Node *cur = database->first; cur != NULL; cur = cur->next)
+  {
+    Node *new = add_to_database (vocab, cur->data->data);
+    if (new == NULL)
+    {
+      free (merged);
+      return EXIT_FAILURE;
+    }
+    merged[cur->data->id] = (uint32_t) new->data->id;
+  }
+  for (size_t i = 0; i < shard->token_num; i++)
+  {
+    shard->tokens[i] = merged[shard->tokens[i]];
+  }
+  free (merged);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Reads the words of a corpus into the vocabulary with thread_num threads,
+ * see train_ngrams_on_file.
+ * @param corpus corpus in memory
+ * @param words_to_read number of words to read, -1 to read them all
+ * @param thread_num number of threads
+ * @param token_flags TOKEN_ flags to read the words with
+ * @param vocab chain of words
+ * @param tokens set to the ids of the read words, in corpus order
+ * @param token_num set to the number of read words
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int tokenize (const Corpus *corpus, int words_to_read, int thread_num,
+                     int token_flags, MarkovChain *vocab, uint32_t **tokens,
+                     size_t *token_num)
+{
+  Shard *shards = calloc (thread_num, sizeof (Shard));
+  if (shards == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  split (shards, thread_num, corpus, vocab, token_flags);
+  int ret = EXIT_SUCCESS;
+  if (thread_num == 1)
+  {
+    shards[0].words_to_read = words_to_read;
+    ret = tokenize_words (vocab, &shards[0]);
+  }
+  else
+  {
+    ret = limit_words (shards, thread_num, words_to_read);
+    if (ret == EXIT_SUCCESS)
+    {
+      ret = run_threads (shards, thread_num, tokenize_shard);
+    }
+    for (int i = 0; i < thread_num; i++)
+    {
+      if (ret == EXIT_SUCCESS && shards[i].status == EXIT_SUCCESS)
+      {
+        ret = merge_tokens (vocab, &shards[i]);
+      }
+      else
+      {
+        ret = EXIT_FAILURE;
+      }
+      if (shards[i].partial != NULL)
+      {
+        free_markov_chain (&shards[i].partial);
+      }
+    }
+  }
+  size_t total = 0;
+  for (int i = 0; i < thread_num; i++)
+  {
+    total += shards[i].token_num;
+  }
+  *tokens = ret == EXIT_SUCCESS ? malloc ((total + 1) * sizeof (uint32_t))
+                                : NULL;
+  *token_num = 0;
+  for (int i = 0; i < thread_num; i++)
+  {
+    // a shard with no tokens may have no array either
+    if (*tokens != NULL && shards[i].token_num > 0)
+    {
+      memcpy (*tokens + *token_num, shards[i].tokens,
+              shards[i].token_num * sizeof (uint32_t));
+      *token_num += shards[i].token_num;
+    }
+    free (shards[i].tokens);
+  }
+  free (shards);
+  if (ret == EXIT_SUCCESS && *tokens == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    ret = EXIT_FAILURE;
+  }
+  return ret;
+}
+
+/**
+ * Adds the n-grams of a shard's tokens to a chain, each followed by the
+ * next one.
+ * @param markov_chain chain of n-grams
+ * @param shard shard whose tokens hold its n-grams
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int train_tuples (MarkovChain *markov_chain, Shard *shard)
+{
+  uint32_t ngram[1 + MAX_ORDER];
+  ngram[0] = (uint32_t) shard->order;
+  for (size_t i = 0; i + shard->order <= shard->token_num; i++)
+  {
+    memcpy (ngram + 1, shard->tokens + i, shard->order * sizeof (uint32_t));
+    Node *new = add_to_database (markov_chain, ngram);
+    if (new == NULL)
+    {
+      return EXIT_FAILURE;
+    }
+    if (shard->last != NULL && add_node_to_counter_list (
+        shard->last, new->data, markov_chain) == false)
+    {
+      return EXIT_FAILURE;
+    }
+    if (shard->first == NULL)
+    {
+      shard->first = new->data;
+    }
+    shard->last = new->data;
+  }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * thread routine: builds the partial chain of the n-grams of a shard
+ * @param arg the shard
+ * @return NULL
+ */
+static void *train_tuple_shard (void *arg)
+{
+  Shard *shard = arg;
+  shard->status = EXIT_FAILURE;
+  shard->partial = new_partial_chain (shard->model);
+  if (shard->partial != NULL)
+  {
+    shard->status = train_tuples (shard->partial, shard);
+  }
+  return NULL;
+}
+
+/**
+ * Trains a chain of n-grams on a sequence of tokens with thread_num
+ * threads. Every thread gets a range of the n-grams, and the partial chains
+ * are merged in order like in train_sharded.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int train_tokens (const uint32_t *tokens, size_t token_num, int order,
+                         int thread_num, MarkovChain *markov_chain)
+{
+  size_t ngram_num = token_num < (size_t) order ? 0 : token_num - order + 1;
+  if (thread_num == 1 || ngram_num < (size_t) thread_num)
+  {
+    Shard shard = {NULL, NULL, -1, 0, markov_chain, markov_chain, NULL,
+                   markov_chain->last_state, EXIT_SUCCESS, (uint32_t *) tokens,
+                   token_num, order, 0};
+    int ret = train_tuples (markov_chain, &shard);
+    markov_chain->last_state = shard.last;
+    return ret;
+  }
+  Shard *shards = calloc (thread_num, sizeof (Shard));
+  if (shards == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < thread_num; i++)
+  {
+    size_t begin = ngram_num / thread_num * i;
+    size_t end = i == thread_num - 1 ? ngram_num
+                                     : ngram_num / thread_num * (i + 1);
+    shards[i] = (Shard) {NULL, NULL, -1, 0, markov_chain, NULL, NULL, NULL,
+                         EXIT_FAILURE, (uint32_t *) tokens + begin,
+                         end - begin + order - 1, order, 0};
+  }
+  int ret = run_threads (shards, thread_num, train_tuple_shard);
+  MarkovNode *prev = markov_chain->last_state;
+  for (int i = 0; i < thread_num; i++)
+  {
+    if (ret == EXIT_SUCCESS && shards[i].status == EXIT_SUCCESS)
+    {
+      ret = merge_shard (markov_chain, &shards[i], &prev);
+    }
+    else
+    {
+      ret = EXIT_FAILURE;
+    }
+    if (shards[i].partial != NULL)
+    {
+      free_markov_chain (&shards[i].partial);
+    }
+  }
+  markov_chain->last_state = prev;
+  free (shards);
+  return ret;
+}
+
+/**
+ * Puts the last k - 1 tokens of the n-gram a chain ended at before the new
+ * tokens, so that the first new n-gram follows it.
+ * @param last_state last state of the chain
+ * @param tokens new tokens, reallocated
+ * @param token_num number of new tokens, updated
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int continue_tokens (const MarkovNode *last_state, uint32_t **tokens,
+                            size_t *token_num)
+{
+  const uint32_t *ngram = last_state->data;
+  size_t kept = ngram[0] - 1;
+  uint32_t *temp = realloc (*tokens, (kept + *token_num) * sizeof (uint32_t));
+  if (temp == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  memmove (temp + kept, temp, *token_num * sizeof (uint32_t));
+  memcpy (temp, ngram + 2, kept * sizeof (uint32_t));
+  *tokens = temp;
+  *token_num += kept;
+  return EXIT_SUCCESS;
+}
+
+int train_ngrams_on_file (FILE *fp, int words_to_read, int order,
+                          int thread_num, int token_flags, MarkovChain *vocab,
+                          MarkovChain *markov_chain)
+{
+  Corpus corpus;
+  stats_begin ("ingest");
+  if (map_corpus (fp, &corpus) == false && read_corpus (fp, &corpus) == false)
+  {
+    stats_end ();
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  uint32_t *tokens = NULL;
+  size_t token_num = 0;
+  int ret = tokenize (&corpus, words_to_read, thread_num, token_flags, vocab,
+                      &tokens, &token_num);
+  close_corpus (&corpus);
+  stats_end ();
+  if (ret == EXIT_SUCCESS && markov_chain->last_state != NULL && token_num > 0)
+  {
+    ret = continue_tokens (markov_chain->last_state, &tokens, &token_num);
+  }
+  if (ret == EXIT_SUCCESS)
+  {
+    stats_begin ("training");
+    ret = train_tokens (tokens, token_num, order, thread_num, markov_chain);
+    stats_end ();
+  }
+  free (tokens);
+  return ret;
+}
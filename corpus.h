@@ -0,0 +1,88 @@
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+
+#include "markov_chain.h"
+#include "ngram.h"
+#include "tokenizer.h"
+#include <stdio.h>  // For FILE
+
+#define MAX_THREADS 256
+
+/**
+ * Returns the length of a word: words end at the first ASCII whitespace
+ * or null terminator (see is_token_delim), so a word may point straight
+ * into the text it was read from.
+ * @param word word
+ * @return number of characters in the word
+ */
+size_t word_length (const char *word);
+
+/**
+ * Compares two words (see word_length) like strcmp.
+ * @param a first word
+ * @param b second word
+ * @return 0 if the words are equal, the difference of their first different
+ * characters otherwise
+ */
+int word_cmp (const char *a, const char *b);
+
+/**
+ * Trains a chain of words on a text file. Words are separated by ASCII
+ * whitespace, each word is followed by the next one, and only the first
+ * words_to_read words are read. The data passed to add_to_database is a
+ * word (see word_length), not a null terminated string. The words are read
+ * with next_token and token_flags, so they may be lowercased and words
+ * that aren't valid UTF-8 skipped (see tokenizer.h).
+ *
+ * The chain may already be trained or loaded from a snapshot, in which case
+ * the words are appended: the first one follows the chain's last_state, and
+ * the chain ends up the same as if it was trained on the old and the new
+ * text in one go. The cost depends only on the new text (besides building
+ * the hash index of a loaded chain once). The chain's last_state is set to
+ * the state of the last word read.
+ *
+ * A regular file is memory mapped and words are read straight from the
+ * mapping, anything else (stdin, pipes) is read in chunks. With thread_num
+ * above 1 the file is split into byte ranges at word boundaries, every
+ * thread builds a partial chain out of its range and the partial chains are
+ * merged in file order, giving the same chain as a single thread. Reading
+ * the file is timed as the "ingest" phase and building the chain as the
+ * "training" phase (see stats.h).
+ * @param fp file to read the words from
+ * @param words_to_read number of words to read, -1 to read them all
+ * @param thread_num number of threads, between 1 and MAX_THREADS
+ * @param token_flags TOKEN_ flags to read the words with, or 0
+ * @param markov_chain chain to add the words to
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int train_on_file (FILE *fp, int words_to_read, int thread_num,
+                   int token_flags, MarkovChain *markov_chain);
+
+/**
+ * Trains a chain of order k on a text file: a state is an n-gram (see
+ * ngram.h) of the ids of k consecutive words, and each is followed by the
+ * one starting a word later. Words are read with token_flags and limited to
+ * words_to_read like in train_on_file.
+ *
+ * The words themselves are added to vocab, a chain of words set up like
+ * for train_on_file that gets no edges, in the order they are first seen,
+ * so the id of a token is the id of its word's MarkovNode in vocab. Like
+ * with train_on_file, both chains may already be trained, and the new
+ * n-grams continue from the last k - 1 words of the chain's last_state. The
+ * file is read into memory, split between thread_num threads once for
+ * collecting the words and once more for building the chain of n-grams,
+ * and the result doesn't depend on the number of threads.
+ * @param fp file to read the words from
+ * @param words_to_read number of words to read, -1 to read them all
+ * @param order number of words in a state, between 1 and MAX_ORDER
+ * @param thread_num number of threads, between 1 and MAX_THREADS
+ * @param token_flags TOKEN_ flags to read the words with, or 0
+ * @param vocab chain of words to add the words to
+ * @param markov_chain chain of n-grams to add the n-grams to
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int train_ngrams_on_file (FILE *fp, int words_to_read, int order,
+                          int thread_num, int token_flags, MarkovChain *vocab,
+                          MarkovChain *markov_chain);
+
+#endif /* _CORPUS_H_ */
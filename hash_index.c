@@ -0,0 +1,120 @@
+#include "hash_index.h"
+#include "markov_chain.h"
+#include "stats.h"
+
+HashIndex *new_hash_index (void)
+{
+  HashIndex *index = malloc (sizeof (HashIndex));
+  if (index == NULL)
+  {
+    return NULL;
+  }
+  index->slots = calloc (HASH_INDEX_INIT_CAPACITY, sizeof (Node *));
+  index->hashes = malloc (HASH_INDEX_INIT_CAPACITY * sizeof (unsigned long));
+  if (index->slots == NULL || index->hashes == NULL)
+  {
+    free (index->slots);
+    free (index->hashes);
+    free (index);
+    return NULL;
+  }
+  index->capacity = HASH_INDEX_INIT_CAPACITY;
+  index->size = 0;
+  return index;
+}
+
+Node *hash_index_find (const HashIndex *index, unsigned long hash,
+                       const void *data,
+                       int (*comp) (const void *, const void *))
+{
+  unsigned long mask = (unsigned long) index->capacity - 1;
+  unsigned long i = hash & mask;
+  while (index->slots[i] != NULL)
+  {
+    if (index->hashes[i] == hash)
+    {
+      STATS_ADD (lookup_comparisons, 1);
+      if (comp (index->slots[i]->data->data, data) == 0)
+      {
+        return index->slots[i];
+      }
+    }
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
+
+/**
+ * puts a node in the first free slot of its probe sequence
+ * @param slots slots array
+ * @param hashes hashes array
+ * @param mask capacity - 1
+ * @param hash hash of node's data
+ * @param node node to put
+ */
+static void place (Node **slots, unsigned long *hashes, unsigned long mask,
+                   unsigned long hash, Node *node)
+{
+  unsigned long i = hash & mask;
+  while (slots[i] != NULL)
+  {
+    i = (i + 1) & mask;
+  }
+  slots[i] = node;
+  hashes[i] = hash;
+}
+
+/**
+ * doubles the capacity of the index and rehashes all of its nodes
+ * @param index index to grow
+ * @return 0 on success, 1 otherwise
+ */
+static int grow (HashIndex *index)
+{
+  int capacity = index->capacity * 2;
+  Node **slots = calloc (capacity, sizeof (Node *));
+  unsigned long *hashes = malloc (capacity * sizeof (unsigned long));
+  if (slots == NULL || hashes == NULL)
+  {
+    free (slots);
+    free (hashes);
+    return 1;
+  }
+  for (int i = 0; i < index->capacity; i++)
+  {
+    if (index->slots[i] != NULL)
+    {
+      place (slots, hashes, (unsigned long) capacity - 1,
+             index->hashes[i], index->slots[i]);
+    }
+  }
+  free (index->slots);
+  free (index->hashes);
+  index->slots = slots;
+  index->hashes = hashes;
+  index->capacity = capacity;
+  return 0;
+}
+
+int hash_index_insert (HashIndex *index, unsigned long hash, Node *node)
+{
+  if ((index->size + 1) * 4 > index->capacity * 3 && grow (index) == 1)
+  {
+    return 1;
+  }
+  place (index->slots, index->hashes, (unsigned long) index->capacity - 1,
+         hash, node);
+  index->size++;
+  return 0;
+}
+
+void free_hash_index (HashIndex *index)
+{
+  if (index == NULL)
+  {
+    return;
+  }
+  free (index->slots);
+  free (index->hashes);
+  free (index);
+}
@@ -0,0 +1,54 @@
+#ifndef _HASH_INDEX_H_
+#define _HASH_INDEX_H_
+#include "linked_list.h"
+#include <stdlib.h> // For malloc()
+
+#define HASH_INDEX_INIT_CAPACITY 64
+
+/**
+ * Open addressing (linear probing) index over the nodes of a LinkedList.
+ * Every slot keeps the full hash of its node's data, so a probe only calls
+ * the comparison function on a real hash match.
+ */
+typedef struct HashIndex {
+    Node **slots;
+    unsigned long *hashes;
+    int capacity; // always a power of 2
+    int size;
+} HashIndex;
+
+/**
+ * Allocates an empty index.
+ * @return pointer to the new index, NULL on allocation failure
+ */
+HashIndex *new_hash_index (void);
+
+/**
+ * Looks for a node whose data is equal to given data.
+ * @param index index to look in
+ * @param hash hash of data
+ * @param data data to look for
+ * @param comp comparison function, returns 0 on equality
+ * @return the matching node, NULL if there is none
+ */
+Node *hash_index_find (const HashIndex *index, unsigned long hash,
+                       const void *data,
+                       int (*comp) (const void *, const void *));
+
+/**
+ * Inserts a node into the index, doubling the table when it is over 3/4
+ * full. The node's data must not already be in the index.
+ * @param index index to insert to
+ * @param hash hash of the node's data
+ * @param node node to insert
+ * @return 0 on success, 1 otherwise
+ */
+int hash_index_insert (HashIndex *index, unsigned long hash, Node *node);
+
+/**
+ * Frees the index (but not the nodes it points to).
+ * @param index index to free
+ */
+void free_hash_index (HashIndex *index);
+
+#endif //_HASH_INDEX_H_
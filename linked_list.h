@@ -21,4 +21,11 @@ typedef struct LinkedList {
  */
 int add (LinkedList *link_list, void *data);
 
+/**
+ * Link an already allocated node at the end of the given link list.
+ * @param link_list Link list to add the node to
+ * @param node node to add, its next is set to NULL
+ */
+void add_node (LinkedList *link_list, Node *node);
+
 #endif //_LINKEDLIST_H_
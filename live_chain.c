@@ -0,0 +1,524 @@
+#include "live_chain.h"
+#include <string.h>
+
+#define LIVE_PAGE_STATES (1 << LIVE_PAGE_BITS)
+#define LIVE_PAGE_MASK (LIVE_PAGE_STATES - 1)
+#define PAGE_BYTES (LIVE_PAGE_STATES * sizeof (LiveState))
+#define DIRTY_WORD_BITS 64
+#define PTRS_INIT_CAPACITY 16
+#define STARTS_INIT_CAPACITY 64
+
+/**
+ * adds a block to a list of blocks
+ * @param list list of blocks
+ * @param ptr block, may be NULL
+ * @param bytes size of the block
+ * @return true on success, false on allocation failure
+ */
+static bool keep (Retired *list, void *ptr, size_t bytes)
+{
+  if (ptr == NULL)
+  {
+    return true;
+  }
+  if (list->ptr_num == list->ptr_capacity)
+  {
+    int capacity = list->ptr_capacity > 0 ? list->ptr_capacity * 2
+                                          : PTRS_INIT_CAPACITY;
+    void **ptrs = realloc (list->ptrs, capacity * sizeof (void *));
+    if (ptrs == NULL)
+    {
+      return false;
+    }
+    list->ptrs = ptrs;
+    list->ptr_capacity = capacity;
+  }
+  list->ptrs[list->ptr_num++] = ptr;
+  list->bytes += bytes;
+  return true;
+}
+
+/**
+ * allocates a block and adds it to a list of blocks
+ * @param list list of blocks
+ * @param bytes size of the block
+ * @return the block, NULL on allocation failure
+ */
+static void *alloc_kept (Retired *list, size_t bytes)
+{
+  void *ptr = malloc (bytes);
+  if (ptr == NULL || keep (list, ptr, bytes) == false)
+  {
+    free (ptr);
+    return NULL;
+  }
+  return ptr;
+}
+
+/**
+ * frees the blocks of a list, and the list's array
+ * @param list list of blocks
+ */
+static void free_blocks (Retired *list)
+{
+  for (int i = 0; i < list->ptr_num; i++)
+  {
+    free (list->ptrs[i]);
+  }
+  free (list->ptrs);
+}
+
+/**
+ * returns the size of the edges of a state
+ * @param edge_num number of edges
+ * @return size of its LiveEdges in bytes
+ */
+static size_t edges_bytes (int edge_num)
+{
+  return sizeof (LiveEdges) + 2 * (size_t) edge_num * sizeof (int);
+}
+
+/**
+ * copies the counter list of a node into new edges
+ * @param markov_node node with at least one successor
+ * @param fresh list to add the edges to
+ * @return the edges, NULL on allocation failure
+ */
+static LiveEdges *new_live_edges (const MarkovNode *markov_node,
+                                  Retired *fresh)
+{
+  int edge_num = markov_node->next_node_ctr;
+  LiveEdges *edges = alloc_kept (fresh, edges_bytes (edge_num));
+  if (edges == NULL)
+  {
+    return NULL;
+  }
+  edges->edge_num = edge_num;
+  int sum = 0;
+  for (int i = 0; i < edge_num; i++)
+  {
+    sum += markov_node->counter_list[i].frequency;
+    edges->edges[i] = markov_node->counter_list[i].id;
+    edges->edges[edge_num + i] = sum;
+  }
+  return edges;
+}
+
+/**
+ * makes a page of a version being built its own: a page still shared with
+ * the previous version is copied, and a page past its pages is allocated
+ * @param version version being built
+ * @param old previous version
+ * @param page number of the page
+ * @param fresh list to add the new page to
+ * @param retired list to add the replaced page to
+ * @return the page, NULL on allocation failure
+ */
+static LiveState *own_page (LiveVersion *version, const LiveVersion *old,
+                            int page, Retired *fresh, Retired *retired)
+{
+  bool shared = page < old->page_num;
+  if (version->pages[page] != NULL
+      && (shared == false || version->pages[page] != old->pages[page]))
+  {
+    return version->pages[page];
+  }
+  LiveState *copy = alloc_kept (fresh, PAGE_BYTES);
+  if (copy == NULL
+      || (shared && keep (retired, old->pages[page], PAGE_BYTES) == false))
+  {
+    return NULL;
+  }
+  if (shared)
+  {
+    memcpy (copy, old->pages[page], PAGE_BYTES);
+  }
+  version->pages[page] = copy;
+  return copy;
+}
+
+/**
+ * republishes the states of the previous version whose counter lists
+ * changed, as their dirty bits tell
+ * @param live_chain live chain
+ * @param version version being built
+ * @param fresh list to add new blocks to
+ * @param retired list to add replaced blocks to
+ * @return true on success, false on allocation failure
+ */
+static bool update_states (LiveChain *live_chain, LiveVersion *version,
+                           Retired *fresh, Retired *retired)
+{
+  const MarkovChain *markov_chain = live_chain->markov_chain;
+  const LiveVersion *old = live_chain->version;
+  for (int w = 0; w < markov_chain->dirty_words
+                  && w * DIRTY_WORD_BITS < old->state_num; w++)
+  {
+    for (uint64_t bits = markov_chain->dirty[w]; bits != 0; bits &= bits - 1)
+    {
+      int id = w * DIRTY_WORD_BITS + __builtin_ctzll (bits);
+      if (id >= old->state_num)
+      {
+        break; // new states are published by add_states
+      }
+      LiveState *page = own_page (version, old, id >> LIVE_PAGE_BITS, fresh,
+                                  retired);
+      if (page == NULL)
+      {
+        return false;
+      }
+      LiveState *state = &page[id & LIVE_PAGE_MASK];
+      LiveEdges *edges = new_live_edges (state->markov_node, fresh);
+      if (edges == NULL || (state->edges != NULL && keep (
+          retired, (void *) state->edges,
+          edges_bytes (state->edges->edge_num)) == false))
+      {
+        return false;
+      }
+      state->edges = edges;
+    }
+  }
+  return true;
+}
+
+/**
+ * publishes the states added to the chain since the previous version, and
+ * the ones that can start a sequence as starts
+ * @param live_chain live chain
+ * @param version version being built
+ * @param start_capacity set to the capacity of the version's starts
+ * @param fresh list to add new blocks to
+ * @param retired list to add replaced blocks to
+ * @return true on success, false on allocation failure
+ */
+static bool add_states (LiveChain *live_chain, LiveVersion *version,
+                        int *start_capacity, Retired *fresh, Retired *retired)
+{
+  const MarkovChain *markov_chain = live_chain->markov_chain;
+  const LiveVersion *old = live_chain->version;
+  int *starts = live_chain->starts;
+  int start_num = live_chain->start_num;
+  int needed = start_num + version->state_num - old->state_num;
+  *start_capacity = live_chain->start_capacity;
+  if (needed > *start_capacity)
+  {
+    // readers of older versions may be reading the array, so it is copied
+    // instead of reallocated
+    int capacity = *start_capacity * 2 > needed ? *start_capacity * 2
+                                                : needed;
+    capacity = capacity > STARTS_INIT_CAPACITY ? capacity
+                                               : STARTS_INIT_CAPACITY;
+    starts = alloc_kept (fresh, capacity * sizeof (int));
+    if (starts == NULL
+        || keep (retired, live_chain->starts,
+                 *start_capacity * sizeof (int)) == false)
+    {
+      return false;
+    }
+    if (start_num > 0)
+    {
+      memcpy (starts, live_chain->starts, start_num * sizeof (int));
+    }
+    *start_capacity = capacity;
+  }
+  for (int id = old->state_num; id < version->state_num; id++)
+  {
+    LiveState *page = own_page (version, old, id >> LIVE_PAGE_BITS, fresh,
+                                retired);
+    if (page == NULL)
+    {
+      return false;
+    }
+    MarkovNode *markov_node = markov_chain->states[id];
+    LiveState *state = &page[id & LIVE_PAGE_MASK];
+    *state = (LiveState) {markov_node, NULL,
+                          markov_chain->is_last (markov_node)};
+    if (markov_node->next_node_ctr > 0)
+    {
+      state->edges = new_live_edges (markov_node, fresh);
+      if (state->edges == NULL)
+      {
+        return false;
+      }
+    }
+    if (state->is_last == false)
+    {
+      starts[start_num++] = id;
+    }
+  }
+  version->starts = starts;
+  version->start_num = start_num;
+  return true;
+}
+
+/**
+ * frees the retired blocks no reader may hold anymore: those replaced
+ * before the epoch the oldest current reader entered in
+ * @param live_chain live chain
+ */
+static void reclaim (LiveChain *live_chain)
+{
+  unsigned long oldest = live_chain->epoch;
+  for (int i = 0; i < LIVE_MAX_READERS; i++)
+  {
+    unsigned long epoch = __atomic_load_n (&live_chain->readers[i].epoch,
+                                           __ATOMIC_SEQ_CST);
+    if (epoch != 0 && epoch < oldest)
+    {
+      oldest = epoch;
+    }
+  }
+  while (live_chain->retired != NULL && live_chain->retired->epoch < oldest)
+  {
+    Retired *retired = live_chain->retired;
+    live_chain->retired = retired->next;
+    live_chain->bytes -= retired->bytes;
+    free_blocks (retired);
+    free (retired);
+  }
+  if (live_chain->retired == NULL)
+  {
+    live_chain->retired_last = NULL;
+  }
+}
+
+/**
+ * Builds a new version out of the previous one and the states the chain
+ * added or changed since, swaps it in and retires what it replaced. Nothing
+ * is published on failure, and the dirty bits are kept for the next try.
+ * @param live_chain live chain, whose writer holds its lock
+ * @return true on success, false on allocation failure
+ */
+static bool publish (LiveChain *live_chain)
+{
+  MarkovChain *markov_chain = live_chain->markov_chain;
+  LiveVersion *old = live_chain->version;
+  int state_num = markov_chain->database->size;
+  int page_num = (state_num + LIVE_PAGE_MASK) >> LIVE_PAGE_BITS;
+  int start_capacity = 0;
+  Retired fresh = {0};
+  Retired *retired = calloc (1, sizeof (Retired));
+  LiveVersion *version = alloc_kept (&fresh, sizeof (LiveVersion));
+  bool suc = retired != NULL && version != NULL;
+  if (suc)
+  {
+    *version = (LiveVersion) {NULL, page_num, state_num, old->starts,
+                              old->start_num};
+    // a slot more, so that an empty chain gets pages too
+    version->pages = alloc_kept (&fresh,
+                                 (page_num + 1) * sizeof (LiveState *));
+    suc = version->pages != NULL
+          && keep (retired, old, sizeof (LiveVersion))
+          && keep (retired, old->pages,
+                   (old->page_num + 1) * sizeof (LiveState *));
+  }
+  if (suc)
+  {
+    if (old->page_num > 0)
+    {
+      memcpy (version->pages, old->pages,
+              old->page_num * sizeof (LiveState *));
+    }
+    memset (version->pages + old->page_num, 0,
+            (page_num - old->page_num) * sizeof (LiveState *));
+    suc = update_states (live_chain, version, &fresh, retired)
+          && add_states (live_chain, version, &start_capacity, &fresh,
+                         retired);
+  }
+  if (suc == false)
+  {
+    free_blocks (&fresh);
+    if (retired != NULL)
+    {
+      free (retired->ptrs);
+    }
+    free (retired);
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  free (fresh.ptrs);
+  live_chain->bytes += fresh.bytes;
+  live_chain->starts = (int *) version->starts;
+  live_chain->start_num = version->start_num;
+  live_chain->start_capacity = start_capacity;
+  memset (markov_chain->dirty, 0,
+          markov_chain->dirty_words * sizeof (uint64_t));
+  // readers that enter from here on get the new version, and the old one
+  // is freed once those that entered in this epoch or before are done
+  __atomic_store_n (&live_chain->version, version, __ATOMIC_SEQ_CST);
+  retired->epoch = live_chain->epoch;
+  if (live_chain->retired_last != NULL)
+  {
+    live_chain->retired_last->next = retired;
+  }
+  else
+  {
+    live_chain->retired = retired;
+  }
+  live_chain->retired_last = retired;
+  __atomic_store_n (&live_chain->epoch, live_chain->epoch + 1,
+                    __ATOMIC_SEQ_CST);
+  reclaim (live_chain);
+  return true;
+}
+
+LiveChain *new_live_chain (MarkovChain *markov_chain)
+{
+  LiveChain *live_chain = calloc (1, sizeof (LiveChain));
+  LiveVersion *empty = calloc (1, sizeof (LiveVersion));
+  int words = markov_chain->database->size / DIRTY_WORD_BITS + 1;
+  markov_chain->dirty = calloc (words, sizeof (uint64_t));
+  if (live_chain == NULL || empty == NULL || markov_chain->dirty == NULL
+      || pthread_mutex_init (&live_chain->lock, NULL) != 0)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    free (live_chain);
+    free (empty);
+    free (markov_chain->dirty);
+    markov_chain->dirty = NULL;
+    return NULL;
+  }
+  markov_chain->dirty_words = words;
+  live_chain->markov_chain = markov_chain;
+  live_chain->version = empty;
+  live_chain->epoch = 1;
+  live_chain->bytes = sizeof (LiveVersion);
+  if (publish (live_chain) == false)
+  {
+    pthread_mutex_destroy (&live_chain->lock);
+    free (live_chain);
+    free (empty);
+    free (markov_chain->dirty);
+    markov_chain->dirty = NULL;
+    markov_chain->dirty_words = 0;
+    return NULL;
+  }
+  return live_chain;
+}
+
+int register_live_reader (LiveChain *live_chain)
+{
+  for (int i = 0; i < LIVE_MAX_READERS; i++)
+  {
+    int unused = 0;
+    if (__atomic_compare_exchange_n (&live_chain->readers[i].used, &unused, 1,
+                                     false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_RELAXED))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void unregister_live_reader (LiveChain *live_chain, int reader)
+{
+  __atomic_store_n (&live_chain->readers[reader].used, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * returns a state of a version
+ * @param version version
+ * @param id id of the state, below the version's state_num
+ * @return the state
+ */
+static const LiveState *live_state (const LiveVersion *version, int id)
+{
+  return &version->pages[id >> LIVE_PAGE_BITS][id & LIVE_PAGE_MASK];
+}
+
+/**
+ * generate_sequence over a version of a live chain, like walk_frozen
+ * @param version version to walk
+ * @param max_length maximum length of the sequence
+ * @param rng generator
+ * @param sequence filled with the states of the sequence
+ * @return length of the sequence
+ */
+static int walk_version (const LiveVersion *version, int max_length,
+                         MarkovRng *rng, MarkovNode **sequence)
+{
+  if (max_length < 1 || version->start_num == 0)
+  {
+    return 0;
+  }
+  const LiveState *state = live_state (
+      version, version->starts[draw_number (rng, version->start_num)]);
+  sequence[0] = state->markov_node;
+  int len = 1;
+  while (len < max_length && state->edges != NULL)
+  {
+    const LiveEdges *edges = state->edges;
+    const int *cumulative = edges->edges + edges->edge_num;
+    int j = search_cumulative (cumulative, edges->edge_num,
+                               draw_number (rng,
+                                            cumulative[edges->edge_num - 1]));
+    state = live_state (version, edges->edges[j]);
+    sequence[len++] = state->markov_node;
+    if (state->is_last)
+    {
+      break;
+    }
+  }
+  return len;
+}
+
+int generate_live_sequence (LiveChain *live_chain, int reader, int max_length,
+                            MarkovRng *rng, MarkovNode **sequence)
+{
+  ReaderSlot *slot = &live_chain->readers[reader];
+  __atomic_store_n (&slot->epoch,
+                    __atomic_load_n (&live_chain->epoch, __ATOMIC_SEQ_CST),
+                    __ATOMIC_SEQ_CST);
+  const LiveVersion *version = __atomic_load_n (&live_chain->version,
+                                                __ATOMIC_SEQ_CST);
+  int len = walk_version (version, max_length, rng, sequence);
+  __atomic_store_n (&slot->epoch, 0, __ATOMIC_RELEASE);
+  return len;
+}
+
+MarkovChain *live_write_begin (LiveChain *live_chain)
+{
+  pthread_mutex_lock (&live_chain->lock);
+  return live_chain->markov_chain;
+}
+
+bool live_write_end (LiveChain *live_chain)
+{
+  bool suc = publish (live_chain);
+  pthread_mutex_unlock (&live_chain->lock);
+  return suc;
+}
+
+size_t live_chain_memory (const LiveChain *live_chain)
+{
+  return sizeof (LiveChain) + live_chain->bytes;
+}
+
+void free_live_chain (LiveChain **ptr_live)
+{
+  LiveChain *live_chain = *ptr_live;
+  while (live_chain->retired != NULL)
+  {
+    Retired *retired = live_chain->retired;
+    live_chain->retired = retired->next;
+    free_blocks (retired);
+    free (retired);
+  }
+  LiveVersion *version = live_chain->version;
+  for (int id = 0; id < version->state_num; id++)
+  {
+    free ((void *) live_state (version, id)->edges);
+  }
+  for (int page = 0; page < version->page_num; page++)
+  {
+    free (version->pages[page]);
+  }
+  free (version->pages);
+  free (version);
+  free (live_chain->starts);
+  pthread_mutex_destroy (&live_chain->lock);
+  free_markov_chain (&live_chain->markov_chain);
+  free (live_chain);
+  *ptr_live = NULL;
+}
@@ -0,0 +1,180 @@
+#ifndef _LIVE_CHAIN_H_
+#define _LIVE_CHAIN_H_
+#include "markov_chain.h"
+#include <pthread.h>
+
+// maximal number of threads registered to read a live chain at once
+#define LIVE_MAX_READERS 256
+
+// a version holds its states in pages of 1 << LIVE_PAGE_BITS, so that
+// publishing copies only the pages of the states that changed
+#define LIVE_PAGE_BITS 10
+
+#define LIVE_CACHE_LINE 64
+
+/**
+ * The successors of a state in a published version: edges[i] is the id of
+ * successor i and edges[edge_num + i] the running sum of the frequencies up
+ * to it. Never modified once published.
+ */
+typedef struct LiveEdges
+{
+    int edge_num;
+    int edges[];
+} LiveEdges;
+
+typedef struct LiveState
+{
+    MarkovNode *markov_node; // for the chain's callbacks
+    const LiveEdges *edges; // NULL if the state has no successors
+    bool is_last; // is_last of the node when it was published
+} LiveState;
+
+/**
+ * A consistent, read only view of a live chain: the states of ids
+ * [0, state_num), by pages, and the ids of the states a sequence may start
+ * from. A new version shares the pages and edges of the states that didn't
+ * change since the previous one.
+ */
+typedef struct LiveVersion
+{
+    LiveState **pages;
+    int page_num;
+    int state_num;
+    const int *starts; // shared with later versions, which only append
+    int start_num;
+} LiveVersion;
+
+/**
+ * The blocks one publish replaced, freed together once no reader may still
+ * hold them.
+ */
+typedef struct Retired
+{
+    struct Retired *next;
+    void **ptrs;
+    int ptr_num;
+    int ptr_capacity;
+    size_t bytes; // total size of the blocks
+    unsigned long epoch; // epoch they were replaced in
+} Retired;
+
+/**
+ * The epoch a reader entered in, 0 while it reads nothing, alone on its
+ * cache line so readers don't slow each other down.
+ */
+typedef struct ReaderSlot
+{
+    unsigned long epoch;
+    int used;
+    char padding[LIVE_CACHE_LINE - sizeof (unsigned long) - sizeof (int)];
+} ReaderSlot;
+
+/**
+ * A chain one thread at a time trains while any number of threads
+ * generate from it. Writers train the chain itself between
+ * live_write_begin and live_write_end, which publishes a new version of the
+ * states whose counter lists changed (see MarkovChain's dirty bits) and of
+ * the new states, and swaps it in atomically. Readers generate from the
+ * version that was current when they began, without locks: they never wait
+ * for a writer and see either all of a training batch or none of it. The
+ * versions a writer replaces are freed once every reader that could hold
+ * them is done (epoch based reclamation).
+ *
+ * States are never freed while the chain is live, so the MarkovNodes of a
+ * generated sequence stay valid after the reader is done with its version.
+ * The chain can't be decayed, and its last states don't start sequences:
+ * starts are uniform over the other states, like get_first_random_node.
+ */
+typedef struct LiveChain
+{
+    MarkovChain *markov_chain; // only touched by the writer holding lock
+    LiveVersion *version; // current version, read and swapped atomically
+    unsigned long epoch; // advanced by every publish, starts at 1
+    ReaderSlot readers[LIVE_MAX_READERS];
+    pthread_mutex_t lock; // held by the writer
+    Retired *retired; // replaced memory, oldest first
+    Retired *retired_last;
+    int *starts; // ids of the states sequences may start from
+    int start_num;
+    int start_capacity;
+    size_t bytes; // size of the current and retired versions
+} LiveChain;
+
+/**
+ * Makes a trained chain live and publishes its first version. The live
+ * chain owns the chain from then on and frees it with free_live_chain.
+ * @param markov_chain trained chain, not frozen, with nothing else using it
+ * @return the live chain, NULL in case of allocation error (the chain is
+ * left as it was)
+ */
+LiveChain *new_live_chain (MarkovChain *markov_chain);
+
+/**
+ * Registers the calling thread as a reader of a live chain.
+ * @param live_chain live chain
+ * @return the reader's number, to generate with, -1 if LIVE_MAX_READERS
+ * readers are already registered
+ */
+int register_live_reader (LiveChain *live_chain);
+
+/**
+ * Unregisters a reader, which must not be generating.
+ * @param live_chain live chain
+ * @param reader number returned by register_live_reader
+ */
+void unregister_live_reader (LiveChain *live_chain, int reader);
+
+/**
+ * Generates a random sequence from the current version of a live chain,
+ * like generate_sequence, without taking any lock. Safe to call while a
+ * writer trains the chain. Any number of readers may generate at once, each
+ * with its own number and generator.
+ * @param live_chain live chain
+ * @param reader number returned by register_live_reader
+ * @param max_length maximum length of the sequence
+ * @param rng generator to draw from
+ * @param sequence filled with the states of the sequence, must have room
+ * for max_length states
+ * @return length of the sequence, 0 if there is no state to start from
+ */
+int generate_live_sequence (LiveChain *live_chain, int reader, int max_length,
+                            MarkovRng *rng, MarkovNode **sequence);
+
+/**
+ * Starts a training batch: waits for any other writer and returns the
+ * chain to train, with add_to_database, add_node_to_counter_list,
+ * train_on_file and such. Readers keep generating from the last version
+ * meanwhile.
+ * @param live_chain live chain
+ * @return the chain to train
+ */
+MarkovChain *live_write_begin (LiveChain *live_chain);
+
+/**
+ * Ends a training batch: publishes a new version with the states it added
+ * or changed, frees the versions no reader holds anymore and lets the next
+ * writer in. On failure the chain keeps the batch, and the next
+ * live_write_end publishes it.
+ * @param live_chain live chain
+ * @return true on success, false in case of allocation error
+ */
+bool live_write_end (LiveChain *live_chain);
+
+/**
+ * Returns the number of bytes the published versions take: the current
+ * one and those waiting for their readers, not counting the chain itself
+ * (see markov_chain_memory).
+ * @param live_chain live chain, with no writer
+ * @return size of the versions in bytes
+ */
+size_t live_chain_memory (const LiveChain *live_chain);
+
+/**
+ * Frees a live chain, its versions and its chain. No reader may be
+ * generating, nor writer training.
+ * @param live_chain live chain to free
+ */
+void free_live_chain (LiveChain **live_chain);
+
+#endif //_LIVE_CHAIN_H_
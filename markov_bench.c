@@ -0,0 +1,936 @@
+#define _POSIX_C_SOURCE 199309L // For clock_gettime()
+#include "linked_list.h"
+#include "markov_chain.h"
+#include "board.h"
+#include "writer.h"
+#include "ngram.h"
+#include "live_chain.h"
+
+#include <stdio.h>  // For printf(), snprintf()
+#include <stdlib.h> // For exit(), malloc()
+#include <stdbool.h> // for bool
+#include <string.h>
+#include <time.h>
+
+#define USG_ERR "Usage: markov_bench [--linear] [--tsv] [--baseline FILE] \
+[--vocab N] [words]\n"
+#define BASELINE_ERR "Error: Failed to read the baseline file.\n"
+#define NULL_DEVICE "/dev/null"
+#define LINEAR_FLAG "--linear"
+#define TSV_FLAG "--tsv"
+#define BASELINE_FLAG "--baseline"
+#define VOCAB_FLAG "--vocab"
+
+#define MIN_WORDS 10000L
+#define DEFAULT_WORDS 1000000L
+#define SCALE_STEP 10
+#define DEFAULT_VOCAB_SIZE 50000
+#define DOT_EVERY 13
+#define BENCH_SEED 42UL
+#define WORD_BUF 16
+#define NANO 1e9
+#define FNV_OFFSET 14695981039346656037UL
+#define FNV_PRIME 1099511628211UL
+#define BENCH_MAX_ORDER 4
+#define SAMPLES 1000000L
+#define GEN_TWEETS 200000
+#define GEN_MAX_LENGTH 20
+#define SNAKES_WALKS 1000000
+#define SNAKES_MAX_LENGTH 60
+#define MAX_RESULTS 64
+#define PHASE_LEN 64
+#define PERCENT 100
+#define LIVE_BATCH 10000
+
+/**
+ * time a phase took: ops operations in secs seconds, and the bytes the
+ * chain took after it, 0 if not measured
+ */
+typedef struct BenchResult
+{
+    char phase[PHASE_LEN];
+    long ops;
+    double secs;
+    size_t bytes;
+} BenchResult;
+
+/**
+ * results of a run, or of a baseline read back from a file
+ */
+typedef struct BenchResults
+{
+    BenchResult results[MAX_RESULTS];
+    int result_num;
+} BenchResults;
+
+/**
+ * number of distinct words in the corpus
+ */
+static int vocab_size = DEFAULT_VOCAB_SIZE;
+
+/**
+ * deterministic xorshift64* generator, so every run trains on the same corpus
+ * @param state generator state, must not be 0
+ * @return next random value
+ */
+static unsigned long next_rand (unsigned long *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717UL;
+}
+
+/**
+ * builds the synthetic vocabulary: word i is "w<i>", every DOT_EVERY-th word
+ * ends a sentence
+ * @return array of vocab_size words, NULL on allocation failure
+ */
+static char (*make_vocab (void))[WORD_BUF]
+{
+  char (*vocab)[WORD_BUF] = malloc (vocab_size * sizeof (*vocab));
+  if (vocab == NULL)
+  {
+    return NULL;
+  }
+  for (int i = 0; i < vocab_size; i++)
+  {
+    snprintf (vocab[i], WORD_BUF, i % DOT_EVERY == 0 ? "w%d." : "w%d", i);
+  }
+  return vocab;
+}
+
+/**
+ * builds the cumulative Zipf distribution over the vocabulary ranks
+ * @return array of vocab_size cumulative probabilities, NULL on failure
+ */
+static double *make_zipf (void)
+{
+  double *cdf = malloc (vocab_size * sizeof (double));
+  if (cdf == NULL)
+  {
+    return NULL;
+  }
+  double sum = 0;
+  for (int i = 0; i < vocab_size; i++)
+  {
+    sum += 1.0 / (i + 1); // Zipf with exponent 1
+    cdf[i] = sum;
+  }
+  for (int i = 0; i < vocab_size; i++)
+  {
+    cdf[i] /= sum;
+  }
+  return cdf;
+}
+
+/**
+ * draws one vocabulary rank from the Zipf distribution
+ * @param cdf cumulative distribution
+ * @param state generator state
+ * @return rank in [0, vocab_size)
+ */
+static int draw_word (const double *cdf, unsigned long *state)
+{
+  double u = (double) (next_rand (state) >> 11) / (double) (1UL << 53);
+  int lo = 0, hi = vocab_size - 1;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (cdf[mid] < u)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/**
+ * copies a string
+ * @param str_data string to copy
+ * @return newly allocated copy, NULL on allocation failure
+ */
+static void *str_copy (const void *str_data)
+{
+  size_t len = strlen (str_data) + 1;
+  void *ret = malloc (len);
+  if (ret != NULL)
+  {
+    memcpy (ret, str_data, len);
+  }
+  return ret;
+}
+
+/**
+ * frees the string of a node
+ * @param str_p pointer to node containing the string
+ */
+static void str_free (void *str_p)
+{
+  free (((MarkovNode *) str_p)->data);
+}
+
+/**
+ * compares two strings
+ * @return strcmp of the strings
+ */
+static int str_cmp (const void *a, const void *b)
+{
+  return strcmp (a, b);
+}
+
+/**
+ * file and writer the generated tweets go to, see bench_output, and the
+ * number of steps of the snakes and ladders walks, see bench_snakes
+ */
+static FILE *sink = NULL;
+static Writer *sink_writer = NULL;
+static long steps = 0;
+
+/**
+ * prints the string of a node to sink, one printf per token
+ * @param str_p pointer to node containing the string
+ */
+static void str_print (const void *str_p)
+{
+  fprintf (sink, "%s ", (char *) ((MarkovNode *) str_p)->data);
+}
+
+/**
+ * appends the string of a node to sink_writer
+ * @param str_p pointer to node containing the string
+ */
+static void str_write (const void *str_p)
+{
+  const char *str = ((MarkovNode *) str_p)->data;
+  writer_bytes (sink_writer, str, strlen (str));
+  writer_bytes (sink_writer, " ", 1);
+}
+
+/**
+ * checks if a node's string ends a sentence
+ * @param str_p pointer to node containing the string
+ * @return true if it ends with a dot or is marked last, false otherwise
+ */
+static bool dot_at_end (const void *str_p)
+{
+  const MarkovNode *cur = str_p;
+  const char *str = cur->data;
+  return str[strlen (str) - 1] == '.' || cur->is_last;
+}
+
+/**
+ * returns the size of a string, including its null terminator
+ */
+static size_t str_size (const void *str_data)
+{
+  return strlen (str_data) + 1;
+}
+
+/**
+ * hashes a string (FNV-1a)
+ * @param str_data string to hash
+ * @return hash of the string
+ */
+static unsigned long str_hash (const void *str_data)
+{
+  const unsigned char *str = str_data;
+  unsigned long hash = FNV_OFFSET;
+  while (*str != '\0')
+  {
+    hash ^= *str++;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static MARKOV_DEFINE_LOOKUP (str_lookup, str_hash, str_cmp)
+
+/**
+ * allocates an empty chain of strings
+ * @param linear if true, the chain has no hash_func and is searched linearly
+ * @return the chain, NULL on allocation failure
+ */
+static MarkovChain *new_chain (bool linear)
+{
+  MarkovChain *chain = calloc (1, sizeof (*chain));
+  if (chain == NULL)
+  {
+    return NULL;
+  }
+  chain->database = calloc (1, sizeof (LinkedList));
+  if (chain->database == NULL)
+  {
+    free (chain);
+    return NULL;
+  }
+  chain->free_data = str_free;
+  chain->copy_func = str_copy;
+  chain->print_func = str_print;
+  chain->comp_func = str_cmp;
+  chain->is_last = dot_at_end;
+  chain->hash_func = linear ? NULL : str_hash;
+  chain->lookup_func = linear ? NULL : str_lookup;
+  chain->data_size = str_size;
+  return chain;
+}
+
+/**
+ * @return monotonic time in seconds
+ */
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / NANO;
+}
+
+/**
+ * records the result of a phase
+ * @param results results of the run
+ * @param phase name of the phase
+ * @param ops number of operations the phase did
+ * @param secs seconds it took
+ * @param bytes size of the chain after it, 0 if not measured
+ */
+static void record (BenchResults *results, const char *phase, long ops,
+                    double secs, size_t bytes)
+{
+  if (results->result_num == MAX_RESULTS)
+  {
+    return;
+  }
+  BenchResult *result = &results->results[results->result_num++];
+  snprintf (result->phase, PHASE_LEN, "%s", phase);
+  result->ops = ops;
+  result->secs = secs;
+  result->bytes = bytes;
+}
+
+/**
+ * trains a fresh chain on the first n words of the corpus
+ * @param corpus word ranks
+ * @param vocab words
+ * @param n number of words to train on
+ * @param linear whether to search the database linearly
+ * @param results results to record the time in
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int bench_training (const int *corpus, char (*vocab)[WORD_BUF], long n,
+                           bool linear, BenchResults *results)
+{
+  MarkovChain *chain = new_chain (linear);
+  if (chain == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  MarkovNode *prev = NULL;
+  double start = now ();
+  for (long i = 0; i < n; i++)
+  {
+    Node *new = add_to_database (chain, vocab[corpus[i]]);
+    if (new == NULL
+        || (prev != NULL
+            && add_node_to_counter_list (prev, new->data, chain) == false))
+    {
+      free_markov_chain (&chain);
+      return EXIT_FAILURE;
+    }
+    prev = new->data;
+  }
+  double secs = now () - start;
+  char phase[PHASE_LEN];
+  snprintf (phase, PHASE_LEN, "train_%ld", n);
+  record (results, phase, n, secs, markov_chain_memory (chain));
+  free_markov_chain (&chain);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * generates GEN_TWEETS tweets to the null device
+ * @param chain frozen chain
+ * @param buffered if true, the tweets go through a Writer, otherwise they are
+ * printed a token at a time
+ * @param secs set to the time it took
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int bench_output (MarkovChain *chain, bool buffered, double *secs)
+{
+  sink = fopen (NULL_DEVICE, "w");
+  if (sink == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+  sink_writer = buffered ? new_writer (sink, WRITER_CAPACITY) : NULL;
+  if (buffered && sink_writer == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    fclose (sink);
+    return EXIT_FAILURE;
+  }
+  chain->print_func = buffered ? str_write : str_print;
+  srand (BENCH_SEED);
+  double start = now ();
+  for (int i = 0; i < GEN_TWEETS; i++)
+  {
+    generate_random_sequence (chain, NULL, GEN_MAX_LENGTH);
+    if (buffered)
+    {
+      writer_bytes (sink_writer, "\n", 1);
+    }
+    else
+    {
+      fprintf (sink, "\n");
+    }
+  }
+  bool suc = buffered ? free_writer (sink_writer) : fflush (sink) == 0;
+  *secs = now () - start;
+  suc = fclose (sink) == 0 && suc;
+  return suc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * walks the chain from state to state SAMPLES times with
+ * next_random_node, starting over from first when a state has no
+ * successor
+ * @param chain chain of the state
+ * @param first state to start from
+ * @return the last state reached, so the walk can't be optimized away
+ */
+static MarkovNode *walk (const MarkovChain *chain, MarkovNode *first)
+{
+  MarkovNode *cur = first;
+  srand (BENCH_SEED);
+  for (long i = 0; i < SAMPLES; i++)
+  {
+    cur = cur->next_node_ctr == 0 ? first : next_random_node (chain, cur);
+  }
+  return cur;
+}
+
+/**
+ * times each phase of the life of a chain on its own: adding the words to
+ * the database, adding the edges between them, sampling successors,
+ * freezing, generating tweets (through a Writer, and with a printf per
+ * word), compacting, sampling and generating from the compacted chain and
+ * freeing
+ * @param corpus word ranks
+ * @param vocab words
+ * @param n number of words to train on
+ * @param linear whether to search the database linearly
+ * @param results results to record the times in
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int bench_phases (const int *corpus, char (*vocab)[WORD_BUF], long n,
+                         bool linear, BenchResults *results)
+{
+  MarkovChain *chain = new_chain (linear);
+  MarkovNode **nodes = malloc (n * sizeof (MarkovNode *));
+  if (chain == NULL || nodes == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    free (nodes);
+    if (chain != NULL)
+    {
+      free_markov_chain (&chain);
+    }
+    return EXIT_FAILURE;
+  }
+  int ret = EXIT_FAILURE;
+  double start = now ();
+  for (long i = 0; i < n; i++)
+  {
+    Node *new = add_to_database (chain, vocab[corpus[i]]);
+    if (new == NULL)
+    {
+      goto cleanup;
+    }
+    nodes[i] = new->data;
+  }
+  record (results, "add_to_database", n, now () - start, 0);
+  start = now ();
+  for (long i = 1; i < n; i++)
+  {
+    if (add_node_to_counter_list (nodes[i - 1], nodes[i], chain) == false)
+    {
+      goto cleanup;
+    }
+  }
+  record (results, "add_node_to_counter_list", n - 1, now () - start,
+          markov_chain_memory (chain));
+  start = now ();
+  walk (chain, nodes[0]);
+  record (results, "get_next_random_node", SAMPLES, now () - start, 0);
+  int state_num = chain->database->size;
+  start = now ();
+  if (freeze_markov_chain (chain) == false)
+  {
+    goto cleanup;
+  }
+  record (results, "freeze_markov_chain", state_num, now () - start,
+          markov_chain_memory (chain));
+  double secs = 0;
+  if (bench_output (chain, true, &secs) == EXIT_FAILURE)
+  {
+    goto cleanup;
+  }
+  record (results, "generate_random_sequence", GEN_TWEETS, secs, 0);
+  if (bench_output (chain, false, &secs) == EXIT_FAILURE)
+  {
+    goto cleanup;
+  }
+  record (results, "generate_printf", GEN_TWEETS, secs, 0);
+  start = now ();
+  if (compact_markov_chain (chain) == false)
+  {
+    goto cleanup;
+  }
+  record (results, "compact_markov_chain", state_num, now () - start,
+          markov_chain_memory (chain));
+  start = now ();
+  walk (chain, nodes[0]);
+  record (results, "sample_compact", SAMPLES, now () - start,
+          0);
+  if (bench_output (chain, true, &secs) == EXIT_FAILURE)
+  {
+    goto cleanup;
+  }
+  record (results, "generate_compact", GEN_TWEETS, secs, 0);
+  ret = EXIT_SUCCESS;
+cleanup:
+  start = now ();
+  free_markov_chain (&chain);
+  if (ret == EXIT_SUCCESS)
+  {
+    record (results, "free_markov_chain", state_num, now () - start, 0);
+  }
+  free (nodes);
+  return ret;
+}
+
+/**
+ * trains a chain of n-grams of the given order over the corpus ranks
+ * @param corpus word ranks
+ * @param n number of words to train on
+ * @param order number of words in a state
+ * @param results results to record the time and size of the chain in
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int bench_order (const int *corpus, long n, int order,
+                        BenchResults *results)
+{
+  MarkovChain *chain = new_chain (false);
+  if (chain == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  chain->comp_func = ngram_cmp;
+  chain->hash_func = ngram_hash;
+  chain->lookup_func = ngram_lookup;
+  chain->data_size = ngram_size;
+  uint32_t ngram[1 + MAX_ORDER];
+  ngram[0] = (uint32_t) order;
+  MarkovNode *prev = NULL;
+  double start = now ();
+  for (long i = 0; i + order <= n; i++)
+  {
+    for (int j = 0; j < order; j++)
+    {
+      ngram[j + 1] = (uint32_t) corpus[i + j];
+    }
+    Node *new = add_to_database (chain, ngram);
+    if (new == NULL
+        || (prev != NULL
+            && add_node_to_counter_list (prev, new->data, chain) == false))
+    {
+      free_markov_chain (&chain);
+      return EXIT_FAILURE;
+    }
+    prev = new->data;
+  }
+  double secs = now () - start;
+  char phase[PHASE_LEN];
+  snprintf (phase, PHASE_LEN, "train_order_%d", order);
+  record (results, phase, n, secs, markov_chain_memory (chain));
+  free_markov_chain (&chain);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * counts a step of a walk instead of printing it
+ * @param cell_p pointer to node containing the cell
+ */
+static void count_step (const void *cell_p)
+{
+  (void) cell_p;
+  steps++;
+}
+
+/**
+ * walks the snakes and ladders board SNAKES_WALKS times
+ * @param results results to record the time in
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int bench_snakes (BenchResults *results)
+{
+  MarkovChain *chain = calloc (1, sizeof (MarkovChain));
+  if (chain == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  chain->database = calloc (1, sizeof (LinkedList));
+  if (chain->database == NULL)
+  {
+    free (chain);
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  set_board_chain (chain);
+  chain->print_func = count_step;
+  if (fill_board_database (chain) == EXIT_FAILURE
+      || freeze_markov_chain (chain) == false)
+  {
+    free_markov_chain (&chain);
+    return EXIT_FAILURE;
+  }
+  srand (BENCH_SEED);
+  double start = now ();
+  for (int i = 0; i < SNAKES_WALKS; i++)
+  {
+    generate_random_sequence (chain, chain->database->first->data,
+                              SNAKES_MAX_LENGTH);
+  }
+  record (results, "snakes_walks", SNAKES_WALKS, now () - start, 0);
+  free_markov_chain (&chain);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * A reader of a live chain, timing every sequence it generates.
+ */
+typedef struct LiveReaderJob
+{
+    LiveChain *live_chain;
+    double secs; // time of all the sequences
+    double slowest; // time of the slowest one
+    long tokens; // states generated, so the sequences can't be optimized away
+} LiveReaderJob;
+
+/**
+ * thread routine: generates GEN_TWEETS sequences from a live chain
+ * @param arg the LiveReaderJob
+ * @return NULL
+ */
+static void *read_live (void *arg)
+{
+  LiveReaderJob *job = arg;
+  int reader = register_live_reader (job->live_chain);
+  MarkovNode *sequence[GEN_MAX_LENGTH];
+  MarkovRng rng;
+  seed_markov_rng (&rng, BENCH_SEED, 0);
+  job->secs = 0;
+  job->slowest = 0;
+  for (int i = 0; i < GEN_TWEETS && reader >= 0; i++)
+  {
+    double start = now ();
+    job->tokens += generate_live_sequence (job->live_chain, reader,
+                                           GEN_MAX_LENGTH, &rng, sequence);
+    double secs = now () - start;
+    job->secs += secs;
+    job->slowest = secs > job->slowest ? secs : job->slowest;
+  }
+  if (reader >= 0)
+  {
+    unregister_live_reader (job->live_chain, reader);
+  }
+  return NULL;
+}
+
+/**
+ * adds words [from, to) of the corpus to a chain, each following the one
+ * before
+ * @param chain chain to train
+ * @param corpus word ranks
+ * @param vocab words
+ * @param from first word
+ * @param to end of the words
+ * @param prev last word added before, or NULL, set to the last word added
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int add_words (MarkovChain *chain, const int *corpus,
+                      char (*vocab)[WORD_BUF], long from, long to,
+                      MarkovNode **prev)
+{
+  for (long i = from; i < to; i++)
+  {
+    Node *new = add_to_database (chain, vocab[corpus[i]]);
+    if (new == NULL
+        || (*prev != NULL
+            && add_node_to_counter_list (*prev, new->data, chain) == false))
+    {
+      return EXIT_FAILURE;
+    }
+    *prev = new->data;
+  }
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Generates from a live chain trained on the first half of the corpus, on
+ * its own and then from another thread while the second half is trained
+ * in batches of LIVE_BATCH words, each published as a new version. The
+ * slowest sequence of each run shows whether training stalls readers.
+ * @param corpus word ranks
+ * @param vocab words
+ * @param n number of words in the corpus
+ * @param results results to record the times in
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int bench_live (const int *corpus, char (*vocab)[WORD_BUF], long n,
+                       BenchResults *results)
+{
+  MarkovChain *chain = new_chain (false);
+  MarkovNode *prev = NULL;
+  if (chain == NULL || add_words (chain, corpus, vocab, 0, n / 2, &prev)
+                       == EXIT_FAILURE)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    if (chain != NULL)
+    {
+      free_markov_chain (&chain);
+    }
+    return EXIT_FAILURE;
+  }
+  LiveChain *live_chain = new_live_chain (chain);
+  if (live_chain == NULL)
+  {
+    free_markov_chain (&chain);
+    return EXIT_FAILURE;
+  }
+  LiveReaderJob job = {live_chain, 0, 0, 0};
+  read_live (&job);
+  record (results, "live_generate_idle", GEN_TWEETS, job.secs, 0);
+  record (results, "live_slowest_idle", 1, job.slowest, 0);
+  pthread_t thread;
+  bool threaded = pthread_create (&thread, NULL, read_live, &job) == 0;
+  int ret = EXIT_SUCCESS;
+  double start = now ();
+  for (long i = n / 2; i < n && ret == EXIT_SUCCESS; i += LIVE_BATCH)
+  {
+    MarkovChain *batch = live_write_begin (live_chain);
+    ret = add_words (batch, corpus, vocab, i,
+                     i + LIVE_BATCH < n ? i + LIVE_BATCH : n, &prev);
+    if (live_write_end (live_chain) == false)
+    {
+      ret = EXIT_FAILURE;
+    }
+  }
+  double secs = now () - start;
+  if (threaded)
+  {
+    pthread_join (thread, NULL);
+  }
+  else
+  {
+    read_live (&job);
+  }
+  if (ret == EXIT_SUCCESS)
+  {
+    record (results, "live_train_publish", n - n / 2, secs,
+            live_chain_memory (live_chain));
+    record (results, "live_generate_training", GEN_TWEETS, job.secs, 0);
+    record (results, "live_slowest_training", 1, job.slowest, 0);
+  }
+  free_live_chain (&live_chain);
+  return ret;
+}
+
+/**
+ * reads results printed with --tsv
+ * @param path path of the file
+ * @param baseline filled with the results
+ * @return true on success, false if the file couldn't be read
+ */
+static bool read_baseline (const char *path, BenchResults *baseline)
+{
+  FILE *fp = fopen (path, "r");
+  if (fp == NULL)
+  {
+    return false;
+  }
+  char line[BUFSIZ];
+  baseline->result_num = 0;
+  while (fgets (line, sizeof (line), fp) != NULL
+         && baseline->result_num < MAX_RESULTS)
+  {
+    BenchResult *result = &baseline->results[baseline->result_num];
+    double ops_per_sec;
+    if (sscanf (line, "%63s %ld %lf %lf %zu", result->phase, &result->ops,
+                &result->secs, &ops_per_sec, &result->bytes) == 5)
+    {
+      baseline->result_num++;
+    }
+  }
+  fclose (fp);
+  return baseline->result_num > 0;
+}
+
+/**
+ * looks for the result of a phase
+ * @param results results to look in, may be NULL
+ * @param phase name of the phase
+ * @return the result, NULL if the phase isn't there
+ */
+static const BenchResult *find_result (const BenchResults *results,
+                                       const char *phase)
+{
+  for (int i = 0; results != NULL && i < results->result_num; i++)
+  {
+    if (strcmp (results->results[i].phase, phase) == 0)
+    {
+      return &results->results[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * prints the results as a table, or tab separated with --tsv, with the
+ * change in operations per second from the baseline if there is one
+ * @param results results of the run
+ * @param baseline results to compare to, or NULL
+ * @param tsv whether to print tab separated values
+ */
+static void print_results (const BenchResults *results,
+                           const BenchResults *baseline, bool tsv)
+{
+  const char *format = tsv ? "%s\t%s\t%s\t%s\t%s" : "%-26s %10s %10s %14s %12s";
+  printf (format, "phase", "ops", "seconds", "ops_per_sec", "bytes");
+  printf (baseline == NULL ? "\n" : tsv ? "\tvs_baseline\n" : " %12s\n",
+          "vs_baseline");
+  for (int i = 0; i < results->result_num; i++)
+  {
+    const BenchResult *result = &results->results[i];
+    double rate = result->secs > 0 ? result->ops / result->secs : 0;
+    printf (tsv ? "%s\t%ld\t%.6f\t%.0f\t%zu" : "%-26s %10ld %10.3f %14.0f %12zu",
+            result->phase, result->ops, result->secs, rate, result->bytes);
+    const BenchResult *base = find_result (baseline, result->phase);
+    if (base != NULL && base->secs > 0 && base->ops > 0 && rate > 0)
+    {
+      double change = (rate / (base->ops / base->secs) - 1) * PERCENT;
+      printf (tsv ? "\t%+.1f%%" : " %+11.1f%%", change);
+    }
+    else if (baseline != NULL)
+    {
+      printf (tsv ? "\t-" : " %12s", "-");
+    }
+    printf ("\n");
+  }
+}
+
+/**
+ * Benchmarks a chain of strings on a synthetic Zipf corpus, timing every
+ * phase of its life separately: training from MIN_WORDS up to the given
+ * number of words in steps of x10, then adding the words, adding the
+ * edges, sampling, freezing, generating and freeing, then training chains
+ * of orders 1 to BENCH_MAX_ORDER, walking the snakes and ladders board,
+ * and last generating from a live chain while it is trained.
+ * @param argc num of arguments
+ * @param argv 1) optional --linear, to disable the hash index
+ *             2) optional --tsv, to print tab separated values
+ *             3) optional --baseline FILE, to compare to the output of an
+ *                earlier run with --tsv
+ *             4) optional --vocab N, number of distinct words in the corpus
+ *             5) optional number of words
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int main (int argc, char *argv[])
+{
+  bool linear = false, tsv = false;
+  const char *baseline_path = NULL;
+  long words = DEFAULT_WORDS;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp (argv[i], LINEAR_FLAG) == 0)
+    {
+      linear = true;
+    }
+    else if (strcmp (argv[i], TSV_FLAG) == 0)
+    {
+      tsv = true;
+    }
+    else if (strcmp (argv[i], BASELINE_FLAG) == 0 && i + 1 < argc)
+    {
+      baseline_path = argv[++i];
+    }
+    else if (strcmp (argv[i], VOCAB_FLAG) == 0 && i + 1 < argc)
+    {
+      if (sscanf (argv[++i], "%d", &vocab_size) != 1 || vocab_size < 1)
+      {
+        printf (USG_ERR);
+        return EXIT_FAILURE;
+      }
+    }
+    else if (sscanf (argv[i], "%ld", &words) != 1 || words < 2)
+    {
+      printf (USG_ERR);
+      return EXIT_FAILURE;
+    }
+  }
+  static BenchResults results, baseline;
+  if (baseline_path != NULL && read_baseline (baseline_path, &baseline)
+                               == false)
+  {
+    printf (BASELINE_ERR);
+    return EXIT_FAILURE;
+  }
+  char (*vocab)[WORD_BUF] = make_vocab ();
+  double *cdf = make_zipf ();
+  int *corpus = malloc (words * sizeof (int));
+  if (vocab == NULL || cdf == NULL || corpus == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    free (vocab);
+    free (cdf);
+    free (corpus);
+    return EXIT_FAILURE;
+  }
+  unsigned long state = BENCH_SEED;
+  for (long i = 0; i < words; i++)
+  {
+    corpus[i] = draw_word (cdf, &state);
+  }
+  int ret = EXIT_SUCCESS;
+  for (long n = MIN_WORDS; n < words && ret == EXIT_SUCCESS; n *= SCALE_STEP)
+  {
+    ret = bench_training (corpus, vocab, n, linear, &results);
+  }
+  if (ret == EXIT_SUCCESS)
+  {
+    ret = bench_phases (corpus, vocab, words, linear, &results);
+  }
+  for (int order = 1; order <= BENCH_MAX_ORDER && ret == EXIT_SUCCESS; order++)
+  {
+    ret = bench_order (corpus, words, order, &results);
+  }
+  if (ret == EXIT_SUCCESS)
+  {
+    ret = bench_snakes (&results);
+  }
+  if (ret == EXIT_SUCCESS)
+  {
+    ret = bench_live (corpus, vocab, words, &results);
+  }
+  print_results (&results, baseline_path != NULL ? &baseline : NULL, tsv);
+  free (vocab);
+  free (cdf);
+  free (corpus);
+  return ret;
+}
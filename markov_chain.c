@@ -1,10 +1,49 @@
+#define _POSIX_C_SOURCE 200809L // For munmap()
 #include "linked_list.h"
 #include "markov_chain.h"
+#include "stats.h"
 #include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <stdio.h>  // For printf(), sscanf()
 #include <stdlib.h> // For exit(), malloc()
 #include <stdbool.h> // for bool
 
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ULL
+#define MIX_1 0xBF58476D1CE4E5B9ULL
+#define MIX_2 0x94D049BB133111EBULL
+#define MAX_BATCH_THREADS 256
+#define FIBONACCI_HASH 0x9E3779B9u
+// nodes with at least this many successors search them through a table
+#define SUCCESSOR_INDEX_MIN 16
+#define STATES_INIT_CAPACITY 64
+#define DIRTY_WORD_BITS 64
+// varints hold VARINT_BITS bits per byte, and VARINT_MORE is set on every
+// byte but the last
+#define VARINT_BITS 7
+#define VARINT_MORE 0x80
+// longest varints of a 32 and a 64 bit value
+#define VARINT_MAX_32 5
+#define VARINT_MAX_64 10
+// a compacted state's checkpoint: sum of the frequencies, offset
+#define COMPACT_CHECKPOINT (2 * sizeof (uint32_t))
+#define COMPACT_INIT_BYTES 4096
+// generate_random_sequence allocates longer sequences on the heap
+#define SEQUENCE_STACK_LENGTH 256
+
+typedef struct BatchJob
+{
+    const MarkovChain *markov_chain;
+    uint64_t seed;
+    uint64_t first_index;
+    int sequence_num;
+    int max_length;
+    int worker; // this job generates sequences worker, worker + step, ...
+    int step;
+    MarkovNode **sequences;
+    int *lengths;
+} BatchJob;
+
 /**
 * Get random number between 0 and max_number [0, max_number).
 * @param max_number maximal number to return (not including)
@@ -15,46 +54,392 @@ int get_random_number (int max_number)
   return rand () % max_number;
 }
 
+/**
+ * frees the frozen layout of a chain
+ * @param frozen layout to free, may be NULL
+ */
+static void free_frozen_chain (FrozenChain *frozen)
+{
+  if (frozen == NULL)
+  {
+    return;
+  }
+  free (frozen->states);
+  if (frozen->mapped == false)
+  {
+    free (frozen->targets);
+    free (frozen->cumulative);
+  }
+  free (frozen->starts);
+  free (frozen->start_cumulative);
+  free (frozen->offsets);
+  free (frozen->bytes);
+  free (frozen);
+}
+
+/**
+ * allocates the arrays of a frozen layout
+ * @param state_num number of states
+ * @param edge_num number of edges
+ * @return the layout, NULL on allocation failure
+ */
+static FrozenChain *new_frozen_chain (int state_num, int edge_num)
+{
+  FrozenChain *frozen = calloc (1, sizeof (FrozenChain));
+  if (frozen == NULL)
+  {
+    return NULL;
+  }
+  frozen->states = malloc (state_num * sizeof (FrozenState));
+  frozen->targets = malloc (edge_num * sizeof (int));
+  frozen->cumulative = malloc (edge_num * sizeof (int));
+  if (frozen->states == NULL
+      || (edge_num > 0 && (frozen->targets == NULL
+                           || frozen->cumulative == NULL)))
+  {
+    free_frozen_chain (frozen);
+    return NULL;
+  }
+  frozen->state_num = state_num;
+  frozen->edge_num = edge_num;
+  return frozen;
+}
+
+/**
+ * Drops the frozen layout of the chain, if any, before it is modified. The
+ * counter lists of a compacted chain, or of a chain loaded onto a mapped
+ * snapshot, are decoded back first.
+ * @param markov_chain chain about to be trained
+ * @return true on success, false on allocation failure, in which case the
+ * chain stays frozen
+ */
+static bool thaw_markov_chain (MarkovChain *markov_chain)
+{
+  if (markov_chain->frozen == NULL)
+  {
+    return true;
+  }
+  if (markov_chain->frozen->bytes != NULL || markov_chain->frozen->mapped)
+  {
+    for (Node *cur = markov_chain->database->first; cur != NULL;
+         cur = cur->next)
+    {
+      MarkovNode *node = cur->data;
+      if (node->next_node_ctr == 0 || node->counter_list != NULL)
+      {
+        continue;
+      }
+      NextNodeCounter *counter_list = alloc_counter_list (markov_chain,
+                                                          node->next_node_ctr);
+      if (counter_list == NULL)
+      {
+        printf (ALLOCATION_ERROR_MASSAGE);
+        return false;
+      }
+      read_counter_list (markov_chain, node, counter_list);
+      node->counter_list = counter_list;
+    }
+  }
+  free_frozen_chain (markov_chain->frozen);
+  markov_chain->frozen = NULL;
+  return true;
+}
+
+/**
+ * Builds the hash index of the chain over all the nodes already in its
+ * database.
+ * @param markov_chain chain with a hash_func and no index
+ * @return true on success, false on allocation failure
+ */
+static bool build_index (MarkovChain *markov_chain)
+{
+  markov_chain->index = new_hash_index ();
+  if (markov_chain->index == NULL)
+  {
+    return false;
+  }
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    if (hash_index_insert (markov_chain->index,
+                           markov_chain->hash_func (cur->data->data), cur)
+        == 1)
+    {
+      free_hash_index (markov_chain->index);
+      markov_chain->index = NULL;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Stores a copy of data_ptr in the chain: inside the node if it fits,
+ * otherwise in the chain's arena.
+ * @param markov_chain chain with a data_size function
+ * @param markov_node node the data belongs to
+ * @param data_ptr data to copy
+ * @return the stored copy, NULL on allocation failure
+ */
+static void *store_data (MarkovChain *markov_chain, MarkovNode *markov_node,
+                         const void *data_ptr)
+{
+  size_t size = markov_chain->data_size (data_ptr);
+  void *dest = markov_node->inline_data;
+  if (size > MARKOV_INLINE_SIZE)
+  {
+    if (markov_chain->arena == NULL)
+    {
+      markov_chain->arena = new_arena ();
+      if (markov_chain->arena == NULL)
+      {
+        return NULL;
+      }
+    }
+    dest = arena_alloc (markov_chain->arena, size);
+    if (dest == NULL)
+    {
+      return NULL;
+    }
+  }
+  return memcpy (dest, data_ptr, size);
+}
+
+/**
+ * allocates an item from one of the pools of a chain, creating the pool
+ * first if needed
+ * @param pool pool of the chain
+ * @param item_size size of the pool's items
+ * @return the item, NULL on allocation failure
+ */
+static void *chain_alloc (Pool **pool, size_t item_size)
+{
+  if (*pool == NULL)
+  {
+    *pool = new_pool (item_size);
+    if (*pool == NULL)
+    {
+      return NULL;
+    }
+  }
+  return pool_alloc (*pool);
+}
+
+/**
+ * returns the number of the pool counter lists of a given capacity are
+ * allocated from: the base 2 logarithm of their capacity rounded up
+ * @param capacity number of counters, above 0
+ * @return number of the pool
+ */
+static int counter_class (int capacity)
+{
+  int c = 0;
+  while (c < COUNTER_CLASSES - 1 && (1 << c) < capacity)
+  {
+    c++;
+  }
+  return c;
+}
+
+NextNodeCounter *alloc_counter_list (MarkovChain *markov_chain, int capacity)
+{
+  int c = counter_class (capacity);
+  return chain_alloc (&markov_chain->counter_pools[c],
+                      sizeof (NextNodeCounter) << c);
+}
+
+void free_counter_list (MarkovChain *markov_chain,
+                        NextNodeCounter *counter_list, int capacity)
+{
+  if (counter_list != NULL)
+  {
+    pool_release (markov_chain->counter_pools[counter_class (capacity)],
+                  counter_list);
+  }
+}
+
+/**
+ * allocates a MarkovNode with no data and no edges from the chain's pool
+ * @param markov_chain chain
+ * @return the node, NULL on allocation failure
+ */
+static MarkovNode *new_markov_node (MarkovChain *markov_chain)
+{
+  MarkovNode *markov_node = chain_alloc (&markov_chain->node_pool,
+                                         sizeof (MarkovNode));
+  if (markov_node == NULL)
+  {
+    return NULL;
+  }
+  markov_node->data = NULL;
+  markov_node->next_node_ctr = 0;
+  markov_node->counter_list = NULL;
+  markov_node->successors = NULL;
+  markov_node->chain = markov_chain;
+  markov_node->id = markov_chain->database->size;
+  markov_node->is_last = false;
+  return markov_node;
+}
+
+/**
+ * adds a node to the end of the chain's database, in a Node allocated from
+ * the chain's pool
+ * @param markov_chain chain
+ * @param markov_node node to add
+ * @return the Node holding it, NULL on allocation failure
+ */
+static Node *link_state (MarkovChain *markov_chain, MarkovNode *markov_node)
+{
+  if (markov_node->id == markov_chain->state_capacity)
+  {
+    int capacity = markov_chain->state_capacity > 0
+                   ? markov_chain->state_capacity * 2 : STATES_INIT_CAPACITY;
+    MarkovNode **states = realloc (markov_chain->states,
+                                   capacity * sizeof (MarkovNode *));
+    if (states == NULL)
+    {
+      return NULL;
+    }
+    markov_chain->states = states;
+    markov_chain->state_capacity = capacity;
+  }
+  Node *node = chain_alloc (&markov_chain->list_pool, sizeof (Node));
+  if (node == NULL)
+  {
+    return NULL;
+  }
+  node->data = markov_node;
+  add_node (markov_chain->database, node);
+  markov_chain->states[markov_node->id] = markov_node;
+  return node;
+}
+
+Node *append_state (MarkovChain *markov_chain, void *data)
+{
+  if (thaw_markov_chain (markov_chain) == false)
+  {
+    return NULL;
+  }
+  MarkovNode *markov_node = new_markov_node (markov_chain);
+  if (markov_node == NULL)
+  {
+    return NULL;
+  }
+  markov_node->data = data;
+  Node *node = link_state (markov_chain, markov_node);
+  if (node == NULL)
+  {
+    pool_release (markov_chain->node_pool, markov_node);
+    return NULL;
+  }
+  if (markov_chain->index != NULL
+      && hash_index_insert (markov_chain->index,
+                            markov_chain->hash_func (data), node) == 1)
+  {
+    // the index is rebuilt by the next add_to_database
+    free_hash_index (markov_chain->index);
+    markov_chain->index = NULL;
+  }
+  return node;
+}
+
+/**
+ * searches the hash index of a chain for data, through its lookup_func if
+ * it has one
+ * @param markov_chain chain with a hash index
+ * @param data_ptr data to look for
+ * @param hash set to the hash of the data
+ * @return the Node holding the data, NULL if there is none
+ */
+static Node *index_lookup (const MarkovChain *markov_chain,
+                           const void *data_ptr, unsigned long *hash)
+{
+  STATS_ADD (lookups, 1);
+  if (markov_chain->lookup_func != NULL)
+  {
+    return markov_chain->lookup_func (markov_chain->index, data_ptr, hash);
+  }
+  *hash = markov_chain->hash_func (data_ptr);
+  return hash_index_find (markov_chain->index, *hash, data_ptr,
+                          markov_chain->comp_func);
+}
+
 Node *add_to_database (MarkovChain *markov_chain, void *data_ptr)
 {
-  Node *cur = get_node_from_database (markov_chain, data_ptr);
+  if (markov_chain->hash_func != NULL && markov_chain->index == NULL
+      && build_index (markov_chain) == false)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return NULL;
+  }
+  unsigned long hash = 0;
+  Node *cur = NULL;
+  if (markov_chain->index != NULL)
+  {
+    cur = index_lookup (markov_chain, data_ptr, &hash);
+  }
+  else
+  {
+    cur = get_node_from_database (markov_chain, data_ptr);
+  }
   if (cur != NULL)
   {
     return cur;
   }
-  MarkovNode *markov_node = malloc (sizeof (*markov_node));
+  if (thaw_markov_chain (markov_chain) == false)
+  {
+    return NULL;
+  }
+  MarkovNode *markov_node = new_markov_node (markov_chain);
   if (markov_node == NULL)
   {
     printf (ALLOCATION_ERROR_MASSAGE);
     return NULL;
   }
-  void *temp = markov_chain->copy_func (data_ptr);
+  void *temp = markov_chain->data_size != NULL
+               ? store_data (markov_chain, markov_node, data_ptr)
+               : markov_chain->copy_func (data_ptr);
   if (temp == NULL)
   {
-    free (markov_node);
+    pool_release (markov_chain->node_pool, markov_node);
     printf (ALLOCATION_ERROR_MASSAGE);
     return NULL;
   }
   markov_node->data = temp;
-  markov_node->next_node_ctr = 0;
-  markov_node->counter_list = NULL;
-  markov_node->is_last = false;
-  int suc = add (markov_chain->database, markov_node);
-  if (suc == 1)
+  if (link_state (markov_chain, markov_node) == NULL)
   {
-    free (markov_node->data);
-    free (markov_node);
+    if (markov_chain->data_size == NULL)
+    {
+      markov_chain->free_data (markov_node);
+    }
+    pool_release (markov_chain->node_pool, markov_node);
     printf (ALLOCATION_ERROR_MASSAGE);
     return NULL;
   }
+  if (markov_chain->index != NULL)
+  {
+    // on failure the node stays in the list and is freed with the chain
+    if (hash_index_insert (markov_chain->index, hash,
+                           markov_chain->database->last) == 1)
+    {
+      printf (ALLOCATION_ERROR_MASSAGE);
+      return NULL;
+    }
+  }
   return markov_chain->database->last;
 }
 
 Node *get_node_from_database (MarkovChain *markov_chain, void *data_ptr)
 {
+  if (markov_chain->index != NULL)
+  {
+    unsigned long hash = 0;
+    return index_lookup (markov_chain, data_ptr, &hash);
+  }
+  STATS_ADD (lookups, 1);
   Node *cur = markov_chain->database->first;
   for (int i = 0; i < markov_chain->database->size; i++)
   {
+    STATS_ADD (lookup_comparisons, 1);
     if (markov_chain->comp_func (cur->data->data, data_ptr) == 0)
     {
       return cur;
@@ -64,14 +449,71 @@ Node *get_node_from_database (MarkovChain *markov_chain, void *data_ptr)
   return NULL;
 }
 
+/**
+ * sets the dirty bit of a node whose counter list is about to change, if
+ * the chain keeps them, growing the bits to cover its id
+ * @param markov_chain chain owning the node
+ * @param markov_node node
+ * @return true on success, false on allocation failure
+ */
+static bool mark_dirty (MarkovChain *markov_chain,
+                        const MarkovNode *markov_node)
+{
+  if (markov_chain->dirty == NULL)
+  {
+    return true;
+  }
+  int word = markov_node->id / DIRTY_WORD_BITS;
+  if (word >= markov_chain->dirty_words)
+  {
+    int words = markov_chain->dirty_words * 2 > word
+                ? markov_chain->dirty_words * 2 : word + 1;
+    uint64_t *dirty = realloc (markov_chain->dirty,
+                               words * sizeof (uint64_t));
+    if (dirty == NULL)
+    {
+      printf (ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+    memset (dirty + markov_chain->dirty_words, 0,
+            (words - markov_chain->dirty_words) * sizeof (uint64_t));
+    markov_chain->dirty = dirty;
+    markov_chain->dirty_words = words;
+  }
+  markov_chain->dirty[word] |= (uint64_t) 1
+                               << (markov_node->id % DIRTY_WORD_BITS);
+  return true;
+}
+
+/**
+ * gets a node's counter list ready to change: thaws the chain, decoding the
+ * counter lists of a compacted one, and marks the node dirty
+ * @param markov_chain chain owning the node
+ * @param markov_node node whose counter list is about to change
+ * @return true on success, false on allocation failure
+ */
+static bool prepare_edit (MarkovChain *markov_chain,
+                          const MarkovNode *markov_node)
+{
+  return thaw_markov_chain (markov_chain)
+         && mark_dirty (markov_chain, markov_node);
+}
+
 NextNodeCounter *check_ctr_list (MarkovChain *markov_chain, MarkovNode *node,
                                  void *data)
 {
+  // the caller may change the counter it gets
+  if (prepare_edit (markov_chain, node) == false)
+  {
+    return NULL;
+  }
   int size = node->next_node_ctr;
+  STATS_ADD (counter_searches, 1);
   for (int i = 0; i < size; i++)
   {
-    if (markov_chain->comp_func (node->counter_list[i].markov_node->data, data)
-        == 0)
+    STATS_ADD (counter_comparisons, 1);
+    if (markov_chain->comp_func (
+        markov_chain->states[node->counter_list[i].id]->data, data) == 0)
     {
       return &(node->counter_list[i]);
     }
@@ -79,161 +521,1725 @@ NextNodeCounter *check_ctr_list (MarkovChain *markov_chain, MarkovNode *node,
   return NULL;
 }
 
-bool new_node_handle (MarkovNode *first_node, MarkovNode *second_node)
+/**
+ * starts the counter list of a node that has none with a counter of 1 for
+ * second node, like new_node_handle on a chain ready to change
+ * @return true if allocation succeeded, false otherwise
+ */
+static bool start_counter_list (MarkovChain *markov_chain,
+                                MarkovNode *first_node,
+                                MarkovNode *second_node)
 {
-  first_node->counter_list = malloc (sizeof (NextNodeCounter));
+  first_node->counter_list = alloc_counter_list (markov_chain, 1);
   if (first_node->counter_list == NULL)
   {
     printf (ALLOCATION_ERROR_MASSAGE);
     return false;
   }
-  first_node->counter_list[0].markov_node = second_node;
+  first_node->counter_list[0].id = second_node->id;
   first_node->counter_list[0].frequency = 1;
   first_node->next_node_ctr = 1;
   return true;
 }
 
-bool extend_node (MarkovChain *markov_chain, MarkovNode *first_node,
-                  MarkovNode *second_node)
+bool new_node_handle (MarkovChain *markov_chain, MarkovNode *first_node,
+                      MarkovNode *second_node)
 {
-  NextNodeCounter *temp = check_ctr_list (markov_chain, first_node,
-                                          second_node->data);
-  if (temp == NULL)
-  {
-    NextNodeCounter *check = realloc (first_node->counter_list, \
-    sizeof (NextNodeCounter) * (first_node->next_node_ctr + 1));
-    if (check == NULL)
-    {
-      printf (ALLOCATION_ERROR_MASSAGE);
-      return false;
-    }
-    first_node->counter_list = check;
-    first_node->next_node_ctr++;
-    first_node->counter_list[first_node->next_node_ctr - 1].markov_node =
-        second_node;
-    first_node->counter_list[first_node->next_node_ctr - 1].frequency = 1;
-  }
-  else
+  return prepare_edit (markov_chain, first_node)
+         && start_counter_list (markov_chain, first_node, second_node);
+}
+
+/**
+ * returns the slot of the successor with a given id in a successor table
+ * (Fibonacci hashing)
+ * @param id id of the successor
+ * @param bits base 2 logarithm of the number of slots
+ * @return the slot its probe sequence starts at
+ */
+static unsigned successor_slot (int id, int bits)
+{
+  return ((uint32_t) id * FIBONACCI_HASH) >> (32 - bits);
+}
+
+/**
+ * returns the size of the successor table of a node with a given number
+ * of successors: 2 slots per counter the list has room for, so the table
+ * is at most half full
+ * @param size number of successors, at least SUCCESSOR_INDEX_MIN
+ * @return base 2 logarithm of the number of slots
+ */
+static int successor_bits (int size)
+{
+  return counter_class (size) + 1;
+}
+
+/**
+ * returns the capacity of the counter list block a successor table is
+ * allocated as: a counter is as big as 2 slots
+ * @param size number of successors, at least SUCCESSOR_INDEX_MIN
+ * @return capacity of the block
+ */
+static int successor_block (int size)
+{
+  return 1 << (successor_bits (size) - 1);
+}
+
+/**
+ * puts the counter at a given position of a node's counter list in the
+ * node's successor table
+ * @param markov_node node with a successor table
+ * @param pos position of the counter
+ */
+static void index_successor (MarkovNode *markov_node, int pos)
+{
+  int bits = successor_bits (markov_node->next_node_ctr);
+  unsigned mask = (1u << bits) - 1;
+  unsigned i = successor_slot (markov_node->counter_list[pos].id, bits);
+  while (markov_node->successors[i] != 0)
   {
-    temp->frequency++;
+    i = (i + 1) & mask;
   }
-  return true;
+  markov_node->successors[i] = pos + 1;
 }
 
-bool add_node_to_counter_list (MarkovNode *first_node, MarkovNode
-*second_node, MarkovChain *markov_chain)
+/**
+ * builds the successor table of a node from its counter list
+ * @param markov_chain chain owning the node
+ * @param markov_node node with no successor table
+ * @return true on success, false on allocation failure
+ */
+static bool build_successors (MarkovChain *markov_chain,
+                              MarkovNode *markov_node)
 {
-  if (first_node->counter_list == NULL)
+  int size = markov_node->next_node_ctr;
+  markov_node->successors = (int *) alloc_counter_list (
+      markov_chain, successor_block (size));
+  if (markov_node->successors == NULL)
   {
-    return new_node_handle (first_node, second_node);
+    return false;
   }
-  else
+  memset (markov_node->successors, 0,
+          sizeof (int) << successor_bits (size));
+  for (int pos = 0; pos < size; pos++)
   {
-    return extend_node (markov_chain, first_node, second_node);
+    index_successor (markov_node, pos);
   }
+  return true;
 }
 
-void free_markov_chain (MarkovChain **ptr_chain)
+/**
+ * releases the successor table of a node, if it has one. Must be called
+ * before its counter list changes capacity.
+ * @param markov_chain chain owning the node
+ * @param markov_node node
+ */
+static void drop_successors (MarkovChain *markov_chain,
+                             MarkovNode *markov_node)
 {
-  MarkovChain chain = **ptr_chain;
-  Node *cur = chain.database->first;
-  Node *temp = NULL;
-  while (cur != NULL)
+  if (markov_node->successors != NULL)
   {
-    temp = cur->next;
-    free (cur->data->counter_list);
-    chain.free_data (cur->data);
-    free (cur->data);
-    free (cur);
-    cur = temp;
+    free_counter_list (markov_chain,
+                       (NextNodeCounter *) markov_node->successors,
+                       successor_block (markov_node->next_node_ctr));
+    markov_node->successors = NULL;
   }
-  free (chain.database);
-  free (*ptr_chain);
 }
 
-MarkovNode *get_first_random_node (MarkovChain *markov_chain)
+/**
+ * finds the counter of a successor in a node's counter list by identity.
+ * Nodes with SUCCESSOR_INDEX_MIN successors or more are searched through
+ * their successor table, built on the first search, others linearly.
+ * @param markov_chain chain owning the node
+ * @param markov_node node to search
+ * @param target successor to look for
+ * @return its counter, NULL if it doesn't follow the node
+ */
+static NextNodeCounter *find_counter (MarkovChain *markov_chain,
+                                      MarkovNode *markov_node,
+                                      const MarkovNode *target)
 {
-  Node *cur = NULL;
-  do
+  int size = markov_node->next_node_ctr;
+  STATS_ADD (counter_searches, 1);
+  if (size >= SUCCESSOR_INDEX_MIN
+      && (markov_node->successors != NULL
+          || build_successors (markov_chain, markov_node)))
+  {
+    int bits = successor_bits (size);
+    unsigned mask = (1u << bits) - 1;
+    unsigned i = successor_slot (target->id, bits);
+    for (; markov_node->successors[i] != 0; i = (i + 1) & mask)
+    {
+      STATS_ADD (counter_comparisons, 1);
+      NextNodeCounter *counter =
+          &markov_node->counter_list[markov_node->successors[i] - 1];
+      if (counter->id == target->id)
+      {
+        return counter;
+      }
+    }
+    return NULL;
+  }
+  for (int i = 0; i < size; i++)
   {
-    int i = get_random_number (markov_chain->database->size);
-    cur = markov_chain->database->first;
-    for (int j = 0; j < i; j++)
+    STATS_ADD (counter_comparisons, 1);
+    if (markov_node->counter_list[i].id == target->id)
     {
-      cur = cur->next;
+      return &markov_node->counter_list[i];
     }
   }
-  while (markov_chain->is_last (cur->data) == true);
-  return cur->data;
+  return NULL;
 }
 
-int get_total_nodes (MarkovNode *state_struct_ptr)
+/**
+ * adds a counter for a new successor at the end of a node's counter list,
+ * moving the list to a block twice as big when it fills its block
+ * @param markov_chain chain owning the node
+ * @param first_node node with a counter list
+ * @param second_node successor not in the list yet
+ * @param frequency frequency of the counter
+ * @return true on success, false on allocation failure
+ */
+static bool append_counter (MarkovChain *markov_chain, MarkovNode *first_node,
+                            MarkovNode *second_node, int frequency)
 {
-  int ret = 0;
-  int range = state_struct_ptr->next_node_ctr;
-  for (int i = 0; i < range; i++)
+  int size = first_node->next_node_ctr;
+  if ((size & (size - 1)) == 0) // the list fills its block
   {
-    int tmp = state_struct_ptr->counter_list[i].frequency;
-    ret += tmp;
+    STATS_ADD (counter_moves, 1);
+    NextNodeCounter *check = alloc_counter_list (markov_chain, size * 2);
+    if (check == NULL)
+    {
+      printf (ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+    memcpy (check, first_node->counter_list, size * sizeof (NextNodeCounter));
+    free_counter_list (markov_chain, first_node->counter_list, size);
+    drop_successors (markov_chain, first_node);
+    first_node->counter_list = check;
   }
-  return ret;
+  first_node->counter_list[size].id = second_node->id;
+  first_node->counter_list[size].frequency = frequency;
+  first_node->next_node_ctr++;
+  if (first_node->successors != NULL)
+  {
+    index_successor (first_node, size);
+  }
+  return true;
 }
 
-MarkovNode *get_next_random_node (MarkovNode *state_struct_ptr)
+/**
+ * adds second node to the first's non empty counter list, like extend_node
+ * on a chain ready to change
+ * @return true if succeeded, false otherwise
+ */
+static bool count_successor (MarkovChain *markov_chain, MarkovNode *first_node,
+                             MarkovNode *second_node)
 {
-  if (state_struct_ptr->counter_list == NULL)
+  NextNodeCounter *temp = find_counter (markov_chain, first_node,
+                                        second_node);
+  if (temp == NULL)
   {
-    return NULL;
+    return append_counter (markov_chain, first_node, second_node, 1);
   }
-  int nodes_num = get_total_nodes (state_struct_ptr);
-  int i = get_random_number (nodes_num);
-  int j = 0;
-  MarkovNode *cur = NULL;
-  while (i >= 0)
-  {
-    cur = state_struct_ptr->counter_list[j].markov_node;
-    i -= state_struct_ptr->counter_list[j].frequency;
-    j++;
-  };
-  return cur;
+  temp->frequency++;
+  return true;
 }
 
-void generate_random_sequence (MarkovChain *markov_chain, MarkovNode *
-first_node, int max_length)
+bool extend_node (MarkovChain *markov_chain, MarkovNode *first_node,
+                  MarkovNode *second_node)
 {
-  MarkovNode *cur = NULL;
-  if (max_length < 2)
+  return prepare_edit (markov_chain, first_node)
+         && count_successor (markov_chain, first_node, second_node);
+}
+
+bool add_node_to_counter_list (MarkovNode *first_node, MarkovNode
+*second_node, MarkovChain *markov_chain)
+{
+  if (prepare_edit (markov_chain, first_node) == false)
   {
+    return false;
+  }
+  bool suc = first_node->counter_list == NULL
+             ? start_counter_list (markov_chain, first_node, second_node)
+             : count_successor (markov_chain, first_node, second_node);
+  if (suc && markov_chain->prune_below > 0
+      && ++markov_chain->edges_since_prune >= markov_chain->prune_interval)
+  {
+    markov_chain->edges_since_prune = 0;
+    return drop_rare_edges (markov_chain, markov_chain->prune_below);
+  }
+  return suc;
+}
+
+bool add_frequency_to_counter_list (MarkovNode *first_node, MarkovNode
+*second_node, int frequency, MarkovChain *markov_chain)
+{
+  if (prepare_edit (markov_chain, first_node) == false)
+  {
+    return false;
+  }
+  if (first_node->counter_list == NULL)
+  {
+    if (start_counter_list (markov_chain, first_node, second_node) == false)
+    {
+      return false;
+    }
+    first_node->counter_list[0].frequency = frequency;
+    return true;
+  }
+  NextNodeCounter *counter = find_counter (markov_chain, first_node,
+                                           second_node);
+  if (counter == NULL)
+  {
+    return append_counter (markov_chain, first_node, second_node, frequency);
+  }
+  counter->frequency += frequency;
+  return true;
+}
+
+/**
+ * compares frequencies in decreasing order, for qsort
+ * @param a first frequency
+ * @param b second frequency
+ * @return negative, 0 or positive if a is bigger, equal or smaller
+ */
+static int compare_frequencies (const void *a, const void *b)
+{
+  int x = *(const int *) a, y = *(const int *) b;
+  return (x < y) - (x > y);
+}
+
+/**
+ * sets the number of counters of a node whose list was cut down to its
+ * first ones, moving the list to a smaller block when it fits one
+ * @param markov_chain chain owning the node
+ * @param markov_node node with no successor table
+ * @param kept number of counters left
+ */
+static void shrink_counters (MarkovChain *markov_chain,
+                             MarkovNode *markov_node, int kept)
+{
+  int size = markov_node->next_node_ctr;
+  markov_node->next_node_ctr = kept;
+  if (kept == 0)
+  {
+    free_counter_list (markov_chain, markov_node->counter_list, size);
+    markov_node->counter_list = NULL;
+    return;
+  }
+  if (counter_class (kept) == counter_class (size))
+  {
+    return;
+  }
+  NextNodeCounter *temp = alloc_counter_list (markov_chain, kept);
+  if (temp == NULL)
+  {
+    // the list stays in its bigger block, which is only ever released to
+    // the pool of a smaller capacity
     return;
   }
-  if (first_node == NULL)
+  memcpy (temp, markov_node->counter_list, kept * sizeof (NextNodeCounter));
+  free_counter_list (markov_chain, markov_node->counter_list, size);
+  markov_node->counter_list = temp;
+}
+
+/**
+ * scales the frequencies of a node's counter list and drops the edges that
+ * reach 0, moving the list to a smaller block when it fits one
+ * @param markov_chain chain owning the node
+ * @param markov_node node to decay
+ * @param numerator numerator of the factor
+ * @param denominator denominator of the factor
+ * @param referenced set to true for the id of every remaining target
+ */
+static void decay_counters (MarkovChain *markov_chain, MarkovNode *markov_node,
+                            int numerator, int denominator, bool *referenced)
+{
+  // the table goes with the positions and ids it was built from
+  drop_successors (markov_chain, markov_node);
+  int kept = 0, size = markov_node->next_node_ctr;
+  for (int i = 0; i < size; i++)
+  {
+    NextNodeCounter counter = markov_node->counter_list[i];
+    counter.frequency = (int) ((long) counter.frequency * numerator
+                               / denominator);
+    if (counter.frequency > 0)
+    {
+      referenced[counter.id] = true;
+      markov_node->counter_list[kept++] = counter;
+    }
+  }
+  shrink_counters (markov_chain, markov_node, kept);
+}
+
+/**
+ * keeps the most frequent successors of a node and those at least as
+ * frequent as a minimum, in their order, and drops the others
+ * @param markov_chain chain owning the node
+ * @param markov_node node to prune
+ * @param min_frequency minimal frequency of a kept edge
+ * @param max_successors maximal number of kept edges, 0 for no maximum
+ * @param frequencies room for the node's next_node_ctr frequencies
+ * @param referenced set to true for the id of every remaining target
+ */
+static void prune_counters (MarkovChain *markov_chain,
+                            MarkovNode *markov_node, int min_frequency,
+                            int max_successors, int *frequencies,
+                            bool *referenced)
+{
+  drop_successors (markov_chain, markov_node);
+  int size = markov_node->next_node_ctr;
+  // the edges as frequent as the last one kept are kept in list order
+  int ties = size;
+  if (max_successors > 0 && size > max_successors)
+  {
+    for (int i = 0; i < size; i++)
+    {
+      frequencies[i] = markov_node->counter_list[i].frequency;
+    }
+    qsort (frequencies, size, sizeof (int), compare_frequencies);
+    int threshold = frequencies[max_successors - 1];
+    if (threshold >= min_frequency)
+    {
+      min_frequency = threshold;
+      ties = max_successors;
+      for (int i = 0; i < max_successors; i++)
+      {
+        ties -= frequencies[i] > threshold;
+      }
+    }
+  }
+  int kept = 0;
+  for (int i = 0; i < size; i++)
+  {
+    NextNodeCounter counter = markov_node->counter_list[i];
+    if (counter.frequency < min_frequency
+        || (counter.frequency == min_frequency && ties-- <= 0))
+    {
+      continue;
+    }
+    referenced[counter.id] = true;
+    markov_node->counter_list[kept++] = counter;
+  }
+  shrink_counters (markov_chain, markov_node, kept);
+}
+
+/**
+ * checks if the data of a node is stored in the chain's arena
+ * @param markov_chain chain
+ * @param markov_node node of the chain
+ * @return true if it is, false if it is inline, mapped or copied
+ */
+static bool in_arena (const MarkovChain *markov_chain,
+                      const MarkovNode *markov_node)
+{
+  const char *data = markov_node->data;
+  const char *snapshot = markov_chain->snapshot;
+  return markov_chain->data_size != NULL
+         && data != markov_node->inline_data
+         && (snapshot == NULL || data < snapshot
+             || data >= snapshot + markov_chain->snapshot_size);
+}
+
+/**
+ * moves the data in the arena of a chain to a new arena holding only the
+ * data of the states still in the database, and frees the old one
+ * @param markov_chain chain
+ * @return true on success, false in case of allocation error (in which
+ * case the old arena is kept)
+ */
+static bool compact_arena (MarkovChain *markov_chain)
+{
+  if (markov_chain->arena == NULL)
+  {
+    return true;
+  }
+  Arena *arena = new_arena ();
+  if (arena == NULL)
+  {
+    return false;
+  }
+  Node *cur = markov_chain->database->first;
+  for (; cur != NULL; cur = cur->next)
+  {
+    if (in_arena (markov_chain, cur->data))
+    {
+      size_t size = markov_chain->data_size (cur->data->data);
+      void *dest = arena_alloc (arena, size);
+      if (dest == NULL)
+      {
+        free_arena (arena);
+        return false;
+      }
+      cur->data->data = memcpy (dest, cur->data->data, size);
+    }
+  }
+  free_arena (markov_chain->arena);
+  markov_chain->arena = arena;
+  return true;
+}
+
+/**
+ * returns the number of bytes a hash index takes
+ * @param index index, may be NULL
+ * @return its size in bytes
+ */
+static size_t index_bytes (const HashIndex *index)
+{
+  if (index == NULL)
+  {
+    return 0;
+  }
+  return sizeof (HashIndex) + index->capacity * (sizeof (Node *)
+                                                 + sizeof (unsigned long));
+}
+
+/**
+ * removes the states no edge leads to and with no successors (other than
+ * last_state) from the database and frees them, renumbers the others to
+ * stay positions in the database and moves the data left in the arena to a
+ * new one
+ * @param markov_chain chain, not frozen
+ * @param referenced by id, whether an edge leads to the state
+ * @return true on success, false in case of allocation error (in which
+ * case the old arena is kept)
+ */
+static bool remove_unreferenced (MarkovChain *markov_chain,
+                                 const bool *referenced)
+{
+  LinkedList *database = markov_chain->database;
+  Node *prev = NULL, *cur = database->first;
+  int id = 0;
+  while (cur != NULL)
+  {
+    Node *next = cur->next;
+    MarkovNode *markov_node = cur->data;
+    if (referenced[markov_node->id] || markov_node->next_node_ctr > 0
+        || markov_node == markov_chain->last_state)
+    {
+      markov_node->id = id++;
+      prev = cur;
+      cur = next;
+      continue;
+    }
+    if (prev == NULL)
+    {
+      database->first = next;
+    }
+    else
+    {
+      prev->next = next;
+    }
+    if (database->last == cur)
+    {
+      database->last = prev;
+    }
+    database->size--;
+    if (markov_chain->data_size == NULL)
+    {
+      markov_chain->free_data (markov_node);
+    }
+    pool_release (markov_chain->node_pool, markov_node);
+    pool_release (markov_chain->list_pool, cur);
+    cur = next;
+  }
+  // states is still indexed by the old ids, which the edges hold
+  for (cur = database->first; cur != NULL; cur = cur->next)
+  {
+    for (int i = 0; i < cur->data->next_node_ctr; i++)
+    {
+      NextNodeCounter *counter = &cur->data->counter_list[i];
+      counter->id = markov_chain->states[counter->id]->id;
+    }
+  }
+  for (cur = database->first; cur != NULL; cur = cur->next)
+  {
+    markov_chain->states[cur->data->id] = cur->data;
+  }
+  // the index has no removal, it is rebuilt by the next add_to_database
+  free_hash_index (markov_chain->index);
+  markov_chain->index = NULL;
+  return compact_arena (markov_chain);
+}
+
+bool decay_markov_chain (MarkovChain *markov_chain, int numerator,
+                         int denominator)
+{
+  if (markov_chain->dirty != NULL || thaw_markov_chain (markov_chain) == false)
+  {
+    return false;
+  }
+  LinkedList *database = markov_chain->database;
+  bool *referenced = calloc (database->size + 1, sizeof (bool));
+  if (referenced == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  for (Node *cur = database->first; cur != NULL; cur = cur->next)
+  {
+    decay_counters (markov_chain, cur->data, numerator, denominator,
+                    referenced);
+  }
+  bool suc = remove_unreferenced (markov_chain, referenced);
+  free (referenced);
+  if (suc == false)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+  }
+  return suc;
+}
+
+/**
+ * moves the counter lists of a chain to new pools holding only them, each
+ * in the smallest block it fits, and frees the old pools with the blocks
+ * released to them. Successor tables are dropped, to be rebuilt by the
+ * next search.
+ * @param markov_chain chain, not frozen
+ * @return true on success, false in case of allocation error (in which
+ * case the old pools are kept)
+ */
+static bool compact_counters (MarkovChain *markov_chain)
+{
+  LinkedList *database = markov_chain->database;
+  NextNodeCounter **lists = malloc ((database->size + 1)
+                                    * sizeof (NextNodeCounter *));
+  if (lists == NULL)
+  {
+    return false;
+  }
+  Pool *pools[COUNTER_CLASSES];
+  memcpy (pools, markov_chain->counter_pools, sizeof (pools));
+  memset (markov_chain->counter_pools, 0, sizeof (pools));
+  bool suc = true;
+  for (Node *cur = database->first; suc && cur != NULL; cur = cur->next)
+  {
+    MarkovNode *markov_node = cur->data;
+    lists[markov_node->id] = NULL;
+    if (markov_node->counter_list != NULL)
+    {
+      lists[markov_node->id] = alloc_counter_list (
+          markov_chain, markov_node->next_node_ctr);
+      suc = lists[markov_node->id] != NULL;
+    }
+  }
+  if (suc)
+  {
+    for (Node *cur = database->first; cur != NULL; cur = cur->next)
+    {
+      MarkovNode *markov_node = cur->data;
+      if (markov_node->counter_list != NULL)
+      {
+        markov_node->counter_list = memcpy (
+            lists[markov_node->id], markov_node->counter_list,
+            markov_node->next_node_ctr * sizeof (NextNodeCounter));
+      }
+      // the tables go with the old pools
+      markov_node->successors = NULL;
+    }
+  }
+  // whichever pools are left out are freed
+  for (int c = 0; c < COUNTER_CLASSES; c++)
+  {
+    free_pool (suc ? pools[c] : markov_chain->counter_pools[c]);
+  }
+  if (suc == false)
+  {
+    memcpy (markov_chain->counter_pools, pools, sizeof (pools));
+  }
+  free (lists);
+  return suc;
+}
+
+bool drop_rare_edges (MarkovChain *markov_chain, int min_frequency)
+{
+  if (markov_chain->dirty != NULL)
+  {
+    return true;
+  }
+  if (thaw_markov_chain (markov_chain) == false)
+  {
+    return false;
+  }
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    MarkovNode *markov_node = cur->data;
+    int kept = 0;
+    for (int i = 0; i < markov_node->next_node_ctr; i++)
+    {
+      if (markov_node->counter_list[i].frequency >= min_frequency)
+      {
+        markov_node->counter_list[kept++] = markov_node->counter_list[i];
+      }
+    }
+    if (kept < markov_node->next_node_ctr)
+    {
+      drop_successors (markov_chain, markov_node);
+      shrink_counters (markov_chain, markov_node, kept);
+    }
+  }
+  return true;
+}
+
+bool prune_markov_chain (MarkovChain *markov_chain, int min_frequency,
+                         int max_successors, size_t *reclaimed)
+{
+  if (markov_chain->dirty != NULL || thaw_markov_chain (markov_chain) == false)
+  {
+    return false;
+  }
+  size_t bytes = markov_chain_memory (markov_chain)
+                 - index_bytes (markov_chain->index);
+  LinkedList *database = markov_chain->database;
+  int max_edges = 0;
+  for (Node *cur = database->first; cur != NULL; cur = cur->next)
+  {
+    if (cur->data->next_node_ctr > max_edges)
+    {
+      max_edges = cur->data->next_node_ctr;
+    }
+  }
+  bool *referenced = calloc (database->size + 1, sizeof (bool));
+  int *frequencies = malloc ((max_edges + 1) * sizeof (int));
+  if (referenced == NULL || frequencies == NULL)
+  {
+    free (referenced);
+    free (frequencies);
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  for (Node *cur = database->first; cur != NULL; cur = cur->next)
+  {
+    prune_counters (markov_chain, cur->data, min_frequency, max_successors,
+                    frequencies, referenced);
+  }
+  bool suc = remove_unreferenced (markov_chain, referenced)
+             && compact_counters (markov_chain);
+  free (referenced);
+  free (frequencies);
+  if (suc == false)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+  }
+  size_t left = markov_chain_memory (markov_chain);
+  *reclaimed = bytes > left ? bytes - left : 0;
+  return suc;
+}
+
+size_t markov_chain_memory (const MarkovChain *markov_chain)
+{
+  size_t bytes = sizeof (MarkovChain) + sizeof (LinkedList)
+                 + pool_bytes (markov_chain->list_pool)
+                 + pool_bytes (markov_chain->node_pool);
+  for (int c = 0; c < COUNTER_CLASSES; c++)
+  {
+    bytes += pool_bytes (markov_chain->counter_pools[c]);
+  }
+  bytes += markov_chain->state_capacity * sizeof (MarkovNode *)
+           + markov_chain->dirty_words * sizeof (uint64_t)
+           + index_bytes (markov_chain->index);
+  if (markov_chain->arena != NULL)
+  {
+    for (ArenaBlock *cur = markov_chain->arena->head; cur != NULL;
+         cur = cur->next)
+    {
+      bytes += sizeof (ArenaBlock) + cur->size;
+    }
+  }
+  const FrozenChain *frozen = markov_chain->frozen;
+  if (frozen != NULL)
+  {
+    bytes += sizeof (FrozenChain) + frozen->start_num * sizeof (int)
+             + (frozen->start_cumulative != NULL
+                ? frozen->start_num * sizeof (int) : 0);
+    if (frozen->bytes != NULL)
+    {
+      bytes += frozen->state_num * sizeof (uint32_t) + frozen->byte_num;
+    }
+    else
+    {
+      // mapped edges are counted with the snapshot
+      bytes += frozen->state_num * sizeof (FrozenState)
+               + (frozen->mapped ? 0 : frozen->edge_num * 2 * sizeof (int));
+    }
+  }
+  return bytes + markov_chain->snapshot_size;
+}
+
+void free_markov_chain (MarkovChain **ptr_chain)
+{
+  MarkovChain chain = **ptr_chain;
+  if (chain.data_size == NULL)
+  {
+    for (Node *cur = chain.database->first; cur != NULL; cur = cur->next)
+    {
+      chain.free_data (cur->data);
+    }
+  }
+  // nodes and counter lists go with their pools, a slab at a time
+  free_pool (chain.list_pool);
+  free_pool (chain.node_pool);
+  for (int c = 0; c < COUNTER_CLASSES; c++)
+  {
+    free_pool (chain.counter_pools[c]);
+  }
+  free (chain.states);
+  free (chain.dirty);
+  free_frozen_chain (chain.frozen);
+  free_hash_index (chain.index);
+  free_arena (chain.arena);
+  if (chain.snapshot != NULL)
+  {
+    munmap (chain.snapshot, chain.snapshot_size);
+  }
+  free (chain.database);
+  free (*ptr_chain);
+}
+
+/**
+ * Counts how many times each state followed a last state, i.e. started a
+ * new sequence, in training.
+ * @param frozen frozen layout with its edges filled
+ * @return array of weights indexed by id, NULL on allocation failure
+ */
+static int *start_weights (const FrozenChain *frozen)
+{
+  int *weights = calloc (frozen->state_num, sizeof (int));
+  if (weights == NULL)
+  {
+    return NULL;
+  }
+  for (int i = 0; i < frozen->state_num; i++)
+  {
+    const FrozenState *state = &frozen->states[i];
+    if (state->is_last == false)
+    {
+      continue;
+    }
+    int prev = 0;
+    for (int e = state->first_edge; e < state->first_edge + state->edge_num;
+         e++)
+    {
+      weights[frozen->targets[e]] += frozen->cumulative[e] - prev;
+      prev = frozen->cumulative[e];
+    }
+  }
+  return weights;
+}
+
+/**
+ * Fills the start states of a frozen layout: every state that is not last,
+ * or, with weight_starts, every such state that started a sequence in
+ * training, with running sums of the weights. Falls back to uniform starts
+ * when no state started a sequence.
+ * @param markov_chain chain being frozen
+ * @param frozen frozen layout with its states and edges filled
+ * @return true on success, false on allocation failure
+ */
+static bool collect_starts (const MarkovChain *markov_chain,
+                            FrozenChain *frozen)
+{
+  if (frozen->state_num == 0)
+  {
+    return true;
+  }
+  frozen->starts = malloc (frozen->state_num * sizeof (int));
+  if (frozen->starts == NULL)
+  {
+    return false;
+  }
+  int *weights = NULL;
+  if (markov_chain->weight_starts)
+  {
+    weights = start_weights (frozen);
+    frozen->start_cumulative = malloc (frozen->state_num * sizeof (int));
+    if (weights == NULL || frozen->start_cumulative == NULL)
+    {
+      free (weights);
+      return false;
+    }
+  }
+  int sum = 0;
+  frozen->start_num = 0;
+  for (int i = 0; i < frozen->state_num; i++)
+  {
+    if (frozen->states[i].is_last || (weights != NULL && weights[i] == 0))
+    {
+      continue;
+    }
+    if (weights != NULL)
+    {
+      sum += weights[i];
+      frozen->start_cumulative[frozen->start_num] = sum;
+    }
+    frozen->starts[frozen->start_num++] = i;
+  }
+  free (weights);
+  if (markov_chain->weight_starts && sum == 0)
+  {
+    free (frozen->start_cumulative);
+    frozen->start_cumulative = NULL;
+    for (int i = 0; i < frozen->state_num; i++)
+    {
+      if (frozen->states[i].is_last == false)
+      {
+        frozen->starts[frozen->start_num++] = i;
+      }
+    }
+  }
+  return true;
+}
+
+bool freeze_markov_chain (MarkovChain *markov_chain)
+{
+  FrozenChain *mapped = markov_chain->frozen;
+  if (mapped != NULL && mapped->mapped && mapped->starts == NULL
+      && mapped->state_num > 0)
+  {
+    // frozen onto a mapped snapshot before is_last could be called
+    for (int i = 0; i < mapped->state_num; i++)
+    {
+      mapped->states[i].is_last = markov_chain->is_last (
+          mapped->states[i].markov_node);
+    }
+    if (collect_starts (markov_chain, mapped) == false)
+    {
+      printf (ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+  }
+  if (markov_chain->frozen != NULL)
+  {
+    return true;
+  }
+  int edge_num = 0;
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    edge_num += cur->data->next_node_ctr;
+  }
+  FrozenChain *frozen = new_frozen_chain (markov_chain->database->size,
+                                          edge_num);
+  if (frozen == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  int edge = 0;
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    MarkovNode *node = cur->data;
+    frozen->states[node->id] = (FrozenState) {node, edge, node->next_node_ctr,
+                                              markov_chain->is_last (node)};
+    int sum = 0;
+    for (int i = 0; i < node->next_node_ctr; i++, edge++)
+    {
+      sum += node->counter_list[i].frequency;
+      frozen->targets[edge] = node->counter_list[i].id;
+      frozen->cumulative[edge] = sum;
+    }
+  }
+  markov_chain->frozen = frozen;
+  if (collect_starts (markov_chain, frozen) == false)
+  {
+    thaw_markov_chain (markov_chain);
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  return true;
+}
+
+bool freeze_mapped_markov_chain (MarkovChain *markov_chain, const int *targets,
+                                 const int *cumulative, int edge_num)
+{
+  if (markov_chain->frozen != NULL)
+  {
+    return false;
+  }
+  FrozenChain *frozen = calloc (1, sizeof (FrozenChain));
+  if (frozen == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  frozen->states = malloc ((markov_chain->database->size + 1)
+                           * sizeof (FrozenState));
+  if (frozen->states == NULL)
+  {
+    free (frozen);
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  // the chain doesn't own the edges, which only thawing copies
+  frozen->targets = (int *) targets;
+  frozen->cumulative = (int *) cumulative;
+  frozen->mapped = true;
+  frozen->state_num = markov_chain->database->size;
+  frozen->edge_num = edge_num;
+  int edge = 0;
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    MarkovNode *node = cur->data;
+    frozen->states[node->id] = (FrozenState) {node, edge, node->next_node_ctr,
+                                              false};
+    edge += node->next_node_ctr;
+  }
+  // is_last and the start states are filled by freeze_markov_chain
+  markov_chain->frozen = frozen;
+  return true;
+}
+
+/**
+ * appends a varint to an encoding
+ * @param pos where to write it, advanced past it
+ * @param value value to encode
+ */
+static void write_varint (uint8_t **pos, uint64_t value)
+{
+  while (value >= VARINT_MORE)
+  {
+    *(*pos)++ = (uint8_t) (value | VARINT_MORE);
+    value >>= VARINT_BITS;
+  }
+  *(*pos)++ = (uint8_t) value;
+}
+
+/**
+ * reads a varint of an encoding
+ * @param pos where to read it, advanced past it
+ * @return the value
+ */
+static inline uint64_t read_varint (const uint8_t **pos)
+{
+  uint64_t value = 0;
+  int shift = 0;
+  while (**pos & VARINT_MORE)
+  {
+    value |= (uint64_t) (*(*pos)++ & (VARINT_MORE - 1)) << shift;
+    shift += VARINT_BITS;
+  }
+  return value | (uint64_t) *(*pos)++ << shift;
+}
+
+/**
+ * reads the frequency of a compacted edge
+ * @param pos where to read it, advanced past it
+ * @return the frequency
+ */
+static inline int read_count (const uint8_t **pos)
+{
+  int count = *(*pos)++;
+  return count < COMPACT_ESCAPE ? count
+                                : COMPACT_ESCAPE + (int) read_varint (pos);
+}
+
+/**
+ * compares counters by successor id, for qsort
+ * @param a first counter
+ * @param b second counter
+ * @return negative, 0 or positive if a's id is smaller, equal or bigger
+ */
+static int compare_counter_ids (const void *a, const void *b)
+{
+  int x = ((const NextNodeCounter *) a)->id;
+  int y = ((const NextNodeCounter *) b)->id;
+  return (x > y) - (x < y);
+}
+
+/**
+ * returns the most bytes a state takes once compacted
+ * @param edge_num number of edges of the state
+ * @return bound on its encoding's size
+ */
+static size_t max_compact_size (int edge_num)
+{
+  return VARINT_MAX_64 + VARINT_MAX_32
+         + (size_t) edge_num * (COMPACT_CHECKPOINT + 2 * VARINT_MAX_32 + 1);
+}
+
+/**
+ * encodes a state of a frozen layout as described in FrozenChain
+ * @param frozen frozen layout with its states and edges
+ * @param state state to encode
+ * @param counters room for the state's edge_num counters
+ * @param pos where to write the state, with max_compact_size bytes of room
+ * @return the end of the encoding
+ */
+static uint8_t *encode_state (const FrozenChain *frozen,
+                              const FrozenState *state,
+                              NextNodeCounter *counters, uint8_t *pos)
+{
+  int edge_num = state->edge_num;
+  write_varint (&pos, (uint64_t) edge_num << 1 | state->is_last);
+  if (edge_num == 0)
+  {
+    return pos;
+  }
+  const int *cumulative = frozen->cumulative + state->first_edge;
+  for (int e = 0; e < edge_num; e++)
   {
-    cur = get_first_random_node (markov_chain);
+    counters[e].id = frozen->targets[state->first_edge + e];
+    counters[e].frequency = cumulative[e] - (e > 0 ? cumulative[e - 1] : 0);
   }
-  else
+  qsort (counters, edge_num, sizeof (NextNodeCounter), compare_counter_ids);
+  write_varint (&pos, (uint64_t) cumulative[edge_num - 1]);
+  uint8_t *checkpoint = pos;
+  pos += (edge_num - 1) / COMPACT_BLOCK * COMPACT_CHECKPOINT;
+  const uint8_t *edges = pos;
+  uint32_t sum = 0;
+  for (int e = 0; e < edge_num; e++)
+  {
+    if (e % COMPACT_BLOCK == 0)
+    {
+      if (e > 0)
+      {
+        uint32_t entry[2] = {sum, (uint32_t) (pos - edges)};
+        memcpy (checkpoint, entry, COMPACT_CHECKPOINT);
+        checkpoint += COMPACT_CHECKPOINT;
+      }
+      write_varint (&pos, (uint64_t) counters[e].id);
+    }
+    else
+    {
+      write_varint (&pos, (uint64_t) (counters[e].id - counters[e - 1].id));
+    }
+    int frequency = counters[e].frequency;
+    if (frequency < COMPACT_ESCAPE)
+    {
+      *pos++ = (uint8_t) frequency;
+    }
+    else
+    {
+      *pos++ = COMPACT_ESCAPE;
+      write_varint (&pos, (uint64_t) (frequency - COMPACT_ESCAPE));
+    }
+    sum += (uint32_t) frequency;
+  }
+  return pos;
+}
+
+/**
+ * encodes every state of a frozen layout into its bytes and offsets
+ * @param frozen frozen layout with its states and edges, not compacted
+ * @return true on success, false on allocation failure or if the encoding
+ * doesn't fit in 4 GB, in which case the layout is left as it was
+ */
+static bool encode_frozen (FrozenChain *frozen)
+{
+  int max_edges = 0;
+  for (int i = 0; i < frozen->state_num; i++)
+  {
+    if (frozen->states[i].edge_num > max_edges)
+    {
+      max_edges = frozen->states[i].edge_num;
+    }
+  }
+  size_t capacity = COMPACT_INIT_BYTES, size = 0;
+  NextNodeCounter *counters = malloc ((max_edges + 1)
+                                      * sizeof (NextNodeCounter));
+  frozen->offsets = malloc ((frozen->state_num + 1) * sizeof (uint32_t));
+  frozen->bytes = malloc (capacity);
+  bool suc = counters != NULL && frozen->offsets != NULL
+             && frozen->bytes != NULL;
+  for (int i = 0; suc && i < frozen->state_num; i++)
+  {
+    size_t need = size + max_compact_size (frozen->states[i].edge_num);
+    if (size > UINT32_MAX)
+    {
+      suc = false;
+      break;
+    }
+    if (need > capacity)
+    {
+      while (capacity < need)
+      {
+        capacity *= 2;
+      }
+      uint8_t *bytes = realloc (frozen->bytes, capacity);
+      if (bytes == NULL)
+      {
+        suc = false;
+        break;
+      }
+      frozen->bytes = bytes;
+    }
+    frozen->offsets[i] = (uint32_t) size;
+    size = encode_state (frozen, &frozen->states[i], counters,
+                         frozen->bytes + size) - frozen->bytes;
+  }
+  free (counters);
+  if (suc == false)
+  {
+    free (frozen->offsets);
+    free (frozen->bytes);
+    frozen->offsets = NULL;
+    frozen->bytes = NULL;
+    return false;
+  }
+  uint8_t *bytes = realloc (frozen->bytes, size > 0 ? size : 1);
+  if (bytes != NULL)
+  {
+    frozen->bytes = bytes;
+  }
+  frozen->byte_num = size;
+  return true;
+}
+
+bool compact_markov_chain (MarkovChain *markov_chain)
+{
+  if (freeze_markov_chain (markov_chain) == false)
+  {
+    return false;
+  }
+  FrozenChain *frozen = markov_chain->frozen;
+  if (frozen->bytes != NULL)
+  {
+    return true;
+  }
+  if (encode_frozen (frozen) == false)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  free (frozen->states);
+  if (frozen->mapped == false)
+  {
+    free (frozen->targets);
+    free (frozen->cumulative);
+  }
+  frozen->states = NULL;
+  frozen->targets = NULL;
+  frozen->cumulative = NULL;
+  frozen->mapped = false;
+  // the counter lists and successor tables go with their pools
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    cur->data->counter_list = NULL;
+    cur->data->successors = NULL;
+  }
+  for (int c = 0; c < COUNTER_CLASSES; c++)
+  {
+    free_pool (markov_chain->counter_pools[c]);
+    markov_chain->counter_pools[c] = NULL;
+  }
+  // rebuilt by the next add_to_database
+  free_hash_index (markov_chain->index);
+  markov_chain->index = NULL;
+  return true;
+}
+
+int read_counter_list (const MarkovChain *markov_chain,
+                       const MarkovNode *markov_node,
+                       NextNodeCounter *counters)
+{
+  int edge_num = markov_node->next_node_ctr;
+  if (edge_num == 0)
+  {
+    return 0;
+  }
+  if (markov_node->counter_list != NULL)
+  {
+    memcpy (counters, markov_node->counter_list,
+            edge_num * sizeof (NextNodeCounter));
+    return edge_num;
+  }
+  const FrozenChain *frozen = markov_chain->frozen;
+  if (frozen->bytes == NULL)
+  {
+    // a state loaded onto a mapped snapshot reads its edges from there
+    int first = frozen->states[markov_node->id].first_edge, prev = 0;
+    for (int e = 0; e < edge_num; e++)
+    {
+      counters[e].id = frozen->targets[first + e];
+      counters[e].frequency = frozen->cumulative[first + e] - prev;
+      prev = frozen->cumulative[first + e];
+    }
+    return edge_num;
+  }
+  const uint8_t *pos = frozen->bytes + frozen->offsets[markov_node->id];
+  read_varint (&pos); // edge_num and is_last
+  read_varint (&pos); // sum of the frequencies
+  pos += (edge_num - 1) / COMPACT_BLOCK * COMPACT_CHECKPOINT;
+  for (int e = 0; e < edge_num; e++)
+  {
+    int id = (int) read_varint (&pos);
+    counters[e].id = e % COMPACT_BLOCK == 0 ? id : counters[e - 1].id + id;
+    counters[e].frequency = read_count (&pos);
+  }
+  return edge_num;
+}
+
+int get_total_nodes (MarkovNode *state_struct_ptr)
+{
+  const FrozenChain *frozen = state_struct_ptr->chain->frozen;
+  if (state_struct_ptr->counter_list == NULL
+      && state_struct_ptr->next_node_ctr > 0)
+  {
+    if (frozen->bytes == NULL)
+    {
+      // a state loaded onto a mapped snapshot has the running sums
+      const FrozenState *state = &frozen->states[state_struct_ptr->id];
+      return frozen->cumulative[state->first_edge + state->edge_num - 1];
+    }
+    // a compacted state stores the sum after its number of edges
+    const uint8_t *pos = frozen->bytes + frozen->offsets[state_struct_ptr->id];
+    read_varint (&pos);
+    return (int) read_varint (&pos);
+  }
+  int ret = 0;
+  int range = state_struct_ptr->next_node_ctr;
+  for (int i = 0; i < range; i++)
+  {
+    int tmp = state_struct_ptr->counter_list[i].frequency;
+    ret += tmp;
+  }
+  return ret;
+}
+
+int search_cumulative (const int *cumulative, int edge_num, int i)
+{
+  int lo = 0, hi = edge_num - 1;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (cumulative[mid] <= i)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/**
+ * Advances a generator (splitmix64).
+ * @param rng generator
+ * @return next 64 random bits
+ */
+static uint64_t next_rng (MarkovRng *rng)
+{
+  uint64_t z = (rng->state += GOLDEN_GAMMA);
+  z = (z ^ (z >> 30)) * MIX_1;
+  z = (z ^ (z >> 27)) * MIX_2;
+  return z ^ (z >> 31);
+}
+
+/**
+ * Get random number between 0 and max_number [0, max_number) from a
+ * generator.
+ * @param rng generator
+ * @param max_number maximal number to return (not including)
+ * @return Random number
+ */
+static int rng_number (MarkovRng *rng, int max_number)
+{
+  return (int) (next_rng (rng) % (uint64_t) max_number);
+}
+
+void seed_markov_rng (MarkovRng *rng, uint64_t seed, uint64_t stream)
+{
+  rng->state = seed;
+  rng->state = next_rng (rng) ^ (stream * MIX_1);
+  next_rng (rng);
+}
+
+int draw_number (MarkovRng *rng, int max_number)
+{
+  return rng != NULL ? rng_number (rng, max_number)
+                     : get_random_number (max_number);
+}
+
+bool has_start_state (const MarkovChain *markov_chain)
+{
+  const FrozenChain *frozen = markov_chain->frozen;
+  if (frozen != NULL && frozen->starts != NULL)
+  {
+    return frozen->start_num > 0;
+  }
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    if (markov_chain->is_last (cur->data) == false)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Draws a state that is not a last state to start a sequence from, like
+ * get_first_random_node, without writing to the chain.
+ * @param markov_chain chain
+ * @param rng generator, NULL to draw from rand ()
+ * @return the chosen state, NULL if every state is a last state
+ */
+static MarkovNode *draw_first (const MarkovChain *markov_chain,
+                               MarkovRng *rng)
+{
+  const FrozenChain *frozen = markov_chain->frozen;
+  STATS_ADD (start_draws, 1);
+  if (frozen != NULL)
+  {
+    if (frozen->start_num == 0)
+    {
+      return NULL;
+    }
+    int i = frozen->start_cumulative == NULL
+            ? draw_number (rng, frozen->start_num)
+            : search_cumulative (frozen->start_cumulative, frozen->start_num,
+                                 draw_number (rng, frozen->start_cumulative[
+                                     frozen->start_num - 1]));
+    return markov_chain->states[frozen->starts[i]];
+  }
+  int size = markov_chain->database->size;
+  for (int retries = 0; size > 0; retries++)
+  {
+    MarkovNode *cur = markov_chain->states[draw_number (rng, size)];
+    if (markov_chain->is_last (cur) == false)
+    {
+      return cur;
+    }
+    STATS_ADD (start_retries, 1);
+    // as many misses in a row as there are states are unlikely unless no
+    // state can start, which one scan then tells
+    if (retries == size && has_start_state (markov_chain) == false)
+    {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Draws the successor of a state of a compacted chain in proportion to the
+ * frequencies of its edges: the checkpoints are searched for the block the
+ * drawn number falls in, which is then decoded up to it.
+ * @param frozen compacted layout
+ * @param id id of the state
+ * @param rng generator, NULL to draw from rand ()
+ * @return id of the chosen state, -1 if the state has no successors
+ */
+static int draw_compact (const FrozenChain *frozen, int id, MarkovRng *rng)
+{
+  const uint8_t *pos = frozen->bytes + frozen->offsets[id];
+  int edge_num = (int) (read_varint (&pos) >> 1);
+  if (edge_num == 0)
+  {
+    return -1;
+  }
+  uint32_t i = (uint32_t) draw_number (rng, (int) read_varint (&pos));
+  int checkpoint_num = (edge_num - 1) / COMPACT_BLOCK;
+  const uint8_t *edges = pos + checkpoint_num * COMPACT_CHECKPOINT;
+  // the last block whose sum before it is at most i
+  int lo = 0, hi = checkpoint_num;
+  uint32_t entry[2] = {0, 0};
+  while (lo < hi)
+  {
+    int mid = (lo + hi + 1) / 2;
+    memcpy (entry, pos + (mid - 1) * COMPACT_CHECKPOINT, COMPACT_CHECKPOINT);
+    if (entry[0] <= i)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid - 1;
+    }
+  }
+  uint32_t sum = 0;
+  if (lo > 0)
+  {
+    memcpy (entry, pos + (lo - 1) * COMPACT_CHECKPOINT, COMPACT_CHECKPOINT);
+    sum = entry[0];
+    edges += entry[1];
+  }
+  int target = (int) read_varint (&edges);
+  sum += (uint32_t) read_count (&edges);
+  while (sum <= i)
+  {
+    target += (int) read_varint (&edges);
+    sum += (uint32_t) read_count (&edges);
+  }
+  return target;
+}
+
+/**
+ * Draws the state following a given one in proportion to the frequencies
+ * of its edges, like get_next_random_node, without writing to the chain. A
+ * frozen chain is searched in O(log k) for k successors.
+ * @param markov_chain chain of the state
+ * @param markov_node state to draw the successor of
+ * @param rng generator, NULL to draw from rand ()
+ * @return the chosen state, NULL if the state has no successors
+ */
+static MarkovNode *draw_next (const MarkovChain *markov_chain,
+                              const MarkovNode *markov_node, MarkovRng *rng)
+{
+  const FrozenChain *frozen = markov_chain->frozen;
+  if (frozen != NULL && frozen->bytes != NULL)
+  {
+    int id = draw_compact (frozen, markov_node->id, rng);
+    return id < 0 ? NULL : markov_chain->states[id];
+  }
+  if (frozen != NULL)
+  {
+    const FrozenState *state = &frozen->states[markov_node->id];
+    if (state->edge_num == 0)
+    {
+      return NULL;
+    }
+    const int *cumulative = frozen->cumulative + state->first_edge;
+    int j = search_cumulative (cumulative, state->edge_num,
+                               draw_number (rng,
+                                            cumulative[state->edge_num - 1]));
+    return frozen->states[frozen->targets[state->first_edge + j]].markov_node;
+  }
+  if (markov_node->counter_list == NULL)
+  {
+    return NULL;
+  }
+  int i = draw_number (rng, get_total_nodes ((MarkovNode *) markov_node));
+  int j = 0;
+  while (i >= 0)
+  {
+    i -= markov_node->counter_list[j].frequency;
+    j++;
+  };
+  return markov_chain->states[markov_node->counter_list[j - 1].id];
+}
+
+/**
+ * generate_sequence over the frozen layout of a chain: the walk goes from
+ * id to id and only touches the states and edges arrays.
+ * @param frozen frozen layout
+ * @param cur id of the first state
+ * @param max_length maximum length of the sequence, at least 1
+ * @param rng generator, NULL to draw from rand ()
+ * @param sequence filled with the states of the sequence
+ * @return length of the sequence
+ */
+static int walk_frozen (const FrozenChain *frozen, int cur, int max_length,
+                        MarkovRng *rng, MarkovNode **sequence)
+{
+  sequence[0] = frozen->states[cur].markov_node;
+  int len = 1;
+  while (len < max_length)
+  {
+    const FrozenState *state = &frozen->states[cur];
+    if (state->edge_num == 0)
+    {
+      break;
+    }
+    const int *cumulative = frozen->cumulative + state->first_edge;
+    int j = search_cumulative (cumulative, state->edge_num,
+                               draw_number (rng,
+                                            cumulative[state->edge_num - 1]));
+    cur = frozen->targets[state->first_edge + j];
+    sequence[len++] = frozen->states[cur].markov_node;
+    if (frozen->states[cur].is_last)
+    {
+      break;
+    }
+  }
+  return len;
+}
+
+/**
+ * generate_sequence over a compacted chain, like walk_frozen.
+ * @param markov_chain compacted chain
+ * @param cur id of the first state
+ * @param max_length maximum length of the sequence, at least 1
+ * @param rng generator, NULL to draw from rand ()
+ * @param sequence filled with the states of the sequence
+ * @return length of the sequence
+ */
+static int walk_compact (const MarkovChain *markov_chain, int cur,
+                         int max_length, MarkovRng *rng,
+                         MarkovNode **sequence)
+{
+  const FrozenChain *frozen = markov_chain->frozen;
+  sequence[0] = markov_chain->states[cur];
+  int len = 1;
+  while (len < max_length)
+  {
+    cur = draw_compact (frozen, cur, rng);
+    if (cur < 0)
+    {
+      break;
+    }
+    sequence[len++] = markov_chain->states[cur];
+    if (frozen->bytes[frozen->offsets[cur]] & 1)
+    {
+      break;
+    }
+  }
+  return len;
+}
+
+int generate_sequence (const MarkovChain *markov_chain, MarkovNode *first_node,
+                       int max_length, MarkovRng *rng, MarkovNode **sequence)
+{
+  if (max_length < 1)
+  {
+    return 0;
+  }
+  MarkovNode *cur = first_node != NULL ? first_node
+                                       : draw_first (markov_chain, rng);
+  if (cur == NULL)
+  {
+    return 0;
+  }
+  if (markov_chain->frozen != NULL && markov_chain->frozen->bytes != NULL)
+  {
+    return walk_compact (markov_chain, cur->id, max_length, rng, sequence);
+  }
+  if (markov_chain->frozen != NULL)
   {
-    cur = first_node;
+    return walk_frozen (markov_chain->frozen, cur->id, max_length, rng,
+                        sequence);
   }
-  markov_chain->print_func (cur);
-  int cur_len = 1;
-  while (cur_len < max_length)
+  sequence[0] = cur;
+  int len = 1;
+  while (len < max_length)
   {
-    cur = get_next_random_node (cur);
+    cur = draw_next (markov_chain, cur, rng);
     if (cur == NULL)
     {
+      break;
+    }
+    sequence[len++] = cur;
+    if (markov_chain->is_last (cur))
+    {
+      break;
+    }
+  }
+  return len;
+}
+
+MarkovNode *get_first_random_node (MarkovChain *markov_chain)
+{
+  return draw_first (markov_chain, NULL);
+}
+
+MarkovNode *get_next_random_node (MarkovNode *state_struct_ptr)
+{
+  return draw_next (state_struct_ptr->chain, state_struct_ptr, NULL);
+}
+
+MarkovNode *next_random_node (const MarkovChain *markov_chain,
+                              MarkovNode *state_struct_ptr)
+{
+  return draw_next (markov_chain, state_struct_ptr, NULL);
+}
+
+void generate_random_sequence (MarkovChain *markov_chain, MarkovNode *
+first_node, int max_length)
+{
+  if (max_length < 2)
+  {
+    return;
+  }
+  MarkovNode *stack_sequence[SEQUENCE_STACK_LENGTH];
+  MarkovNode **sequence = stack_sequence;
+  if (max_length > SEQUENCE_STACK_LENGTH)
+  {
+    sequence = malloc (max_length * sizeof (MarkovNode *));
+    if (sequence == NULL)
+    {
+      printf (ALLOCATION_ERROR_MASSAGE);
       return;
     }
-    if (cur_len == max_length - 1)
+  }
+  int length = generate_sequence (markov_chain, first_node, max_length, NULL,
+                                  sequence);
+  print_sequence (markov_chain, sequence, length, max_length);
+  if (sequence != stack_sequence)
+  {
+    free (sequence);
+  }
+}
+
+/**
+ * thread routine: generates the sequences of one worker of a batch
+ * @param arg the BatchJob
+ * @return NULL
+ */
+static void *run_batch_job (void *arg)
+{
+  const BatchJob *job = arg;
+  for (int i = job->worker; i < job->sequence_num; i += job->step)
+  {
+    MarkovRng rng;
+    seed_markov_rng (&rng, job->seed, job->first_index + i);
+    job->lengths[i] = generate_sequence (job->markov_chain, NULL,
+                                         job->max_length, &rng,
+                                         job->sequences
+                                         + (size_t) i * job->max_length);
+  }
+  return NULL;
+}
+
+bool generate_batch (const MarkovChain *markov_chain, uint64_t seed,
+                     uint64_t first_index, int sequence_num, int max_length,
+                     int thread_num, MarkovNode **sequences, int *lengths)
+{
+  if (markov_chain->frozen == NULL || max_length < 2)
+  {
+    return false;
+  }
+  if (thread_num > MAX_BATCH_THREADS)
+  {
+    thread_num = MAX_BATCH_THREADS;
+  }
+  BatchJob jobs[MAX_BATCH_THREADS];
+  pthread_t threads[MAX_BATCH_THREADS];
+  for (int t = 0; t < thread_num; t++)
+  {
+    jobs[t] = (BatchJob) {markov_chain, seed, first_index, sequence_num,
+                          max_length, t, thread_num, sequences, lengths};
+  }
+  // the calling thread runs the first job, and any job that didn't get a
+  // thread of its own
+  int created = 1;
+  for (; created < thread_num; created++)
+  {
+    if (pthread_create (&threads[created], NULL, run_batch_job,
+                        &jobs[created]) != 0)
     {
-      cur->is_last = true;
+      break;
     }
-    if (markov_chain->is_last (cur))
+  }
+  run_batch_job (&jobs[0]);
+  for (int t = created; t < thread_num; t++)
+  {
+    run_batch_job (&jobs[t]);
+  }
+  for (int t = 1; t < created; t++)
+  {
+    pthread_join (threads[t], NULL);
+  }
+  return true;
+}
+
+void print_sequence (MarkovChain *markov_chain, MarkovNode **sequence,
+                     int length, int max_length)
+{
+  for (int i = 0; i < length; i++)
+  {
+    if (i == max_length - 1)
     {
-      markov_chain->print_func (cur);
-      cur->is_last = false;
+      // a copy marked as last makes print_func end the sequence, without
+      // writing to the shared node or reading the counter list a live
+      // chain's writer may be changing
+      MarkovNode last = {0};
+      last.data = sequence[i]->data;
+      last.id = sequence[i]->id;
+      last.is_last = true;
+      markov_chain->print_func (&last);
       return;
     }
-    markov_chain->print_func (cur);
-    cur_len++;
+    markov_chain->print_func (sequence[i]);
   }
-}
\ No newline at end of file
+}
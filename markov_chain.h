@@ -2,9 +2,27 @@
 #define _MARKOV_CHAIN_H
 
 #include "linked_list.h"
+#include "hash_index.h"
+#include "arena.h"
+#include "pool.h"
+#include "stats.h"
 #include <stdio.h>  // For printf(), sscanf()
 #include <stdlib.h> // For exit(), malloc()
 #include <stdbool.h> // for bool
+#include <stdint.h> // for uint64_t
+
+// data of at most this many bytes is stored inside its MarkovNode
+#define MARKOV_INLINE_SIZE 16
+
+// a compacted state's edges are searched through a checkpoint every
+// COMPACT_BLOCK edges, and frequencies from COMPACT_ESCAPE up take more
+// than a byte (see FrozenChain)
+#define COMPACT_BLOCK 64
+#define COMPACT_ESCAPE 255
+
+// a counter list of n counters takes a block of the smallest power of two
+// capacity >= n, from the chain's pool of that capacity
+#define COUNTER_CLASSES 31
 
 #define ALLOCATION_ERROR_MASSAGE "Allocation failure: \
 Failed to allocate new memory\n"
@@ -18,8 +36,43 @@ typedef int (*GenComp) (const void *, const void *);
 typedef void *(*GenCopy) (const void *);
 typedef bool (*IsLast) (const void *);
 typedef void (*GenFree) (void *);
+typedef unsigned long (*GenHash) (const void *);
+typedef size_t (*GenSize) (const void *);
+typedef struct Node *(*GenLookup) (const HashIndex *, const void *,
+                                   unsigned long *);
 
 
+/**
+ * Defines a GenLookup function called name for a chain whose hash_func is
+ * hash and whose comp_func is comp: it hashes the data and searches the
+ * index for it, like hash_index_find, with hash and comp called directly so
+ * that the compiler can inline them into the probe loop instead of calling
+ * them through pointers on every lookup. Used as
+ *   static MARKOV_DEFINE_LOOKUP (cell_lookup, cell_hash, cell_cmp)
+ * in the file defining hash and comp.
+ */
+#define MARKOV_DEFINE_LOOKUP(name, hash, comp)                                \
+  Node *name (const HashIndex *index, const void *data,                      \
+              unsigned long *hash_ptr)                                        \
+  {                                                                           \
+    unsigned long h = hash (data);                                            \
+    unsigned long mask = (unsigned long) index->capacity - 1;                 \
+    *hash_ptr = h;                                                            \
+    for (unsigned long i = h & mask; index->slots[i] != NULL;                 \
+         i = (i + 1) & mask)                                                  \
+    {                                                                         \
+      if (index->hashes[i] == h)                                              \
+      {                                                                       \
+        STATS_ADD (lookup_comparisons, 1);                                    \
+        if (comp (index->slots[i]->data->data, data) == 0)                    \
+        {                                                                     \
+          return index->slots[i];                                             \
+        }                                                                     \
+      }                                                                       \
+    }                                                                         \
+    return NULL;                                                              \
+  }
+
 /***************************/
 
 
@@ -31,18 +84,99 @@ typedef void (*GenFree) (void *);
 typedef struct MarkovNode
 {
     void *data;
+    // successors of the node with their frequencies. Its block has room for
+    // up to the next power of two counters (see COUNTER_CLASSES), so it
+    // only moves when the number of successors doubles.
     struct NextNodeCounter *counter_list;
+    // open addressing table of positions in counter_list + 1 (0 for an
+    // empty slot), keyed by the successor's id, so that finding a successor
+    // of a node with many of them doesn't scan the list. Built by the first
+    // search of a big enough list, NULL otherwise.
+    int *successors;
+    // chain the node belongs to, which resolves the ids of its successors
+    // for get_next_random_node
+    struct MarkovChain *chain;
+    // holds data owned by the chain when it's short enough, so data points
+    // into the node itself. Kept right after the pointers to stay aligned.
+    char inline_data[MARKOV_INLINE_SIZE];
     int next_node_ctr;
+    int id; // position of the node in the database
     bool is_last;
 } MarkovNode;
 
+/**
+ * An edge: the successor is referred to by its id (see MarkovChain's
+ * states), which keeps a counter at 8 bytes and lets successors be compared
+ * as integers.
+ */
 typedef struct NextNodeCounter
 {
-    MarkovNode *markov_node;
+    int id; // id of the successor
     int frequency;
 } NextNodeCounter;
 
-/* DO NOT ADD or CHANGE variables in this struct */
+typedef struct FrozenState
+{
+    MarkovNode *markov_node; // for the chain's callbacks
+    int first_edge; // index of the state's first edge
+    int edge_num;
+    bool is_last; // is_last of the node when it was frozen
+} FrozenState;
+
+/**
+ * Read only copy of a trained chain in compressed sparse row form: the
+ * edges of state i are targets[first_edge .. first_edge + edge_num) with
+ * the running sums of their frequencies at the same positions of
+ * cumulative. States and edges refer to each other by id.
+ *
+ * A compacted chain (see compact_markov_chain) has no states, targets and
+ * cumulative arrays: the edges of state i are encoded in bytes, starting
+ * at offsets[i], as
+ *   varint edge_num << 1 | is_last
+ *   varint sum of the frequencies, if edge_num > 0
+ *   (edge_num - 1) / COMPACT_BLOCK checkpoints of 2 uint32: the sum of the
+ *     frequencies before edge COMPACT_BLOCK * (j + 1), and its offset from
+ *     the first edge
+ *   the edges sorted by successor id, each a varint id, minus the id of
+ *     the edge before unless it starts a block of COMPACT_BLOCK edges, then
+ *     a byte of frequency, or COMPACT_ESCAPE followed by a varint of the
+ *     frequency - COMPACT_ESCAPE
+ * where a varint holds 7 bits per byte, low bits first, with the top bit
+ * set on every byte but the last.
+ */
+typedef struct FrozenChain
+{
+    FrozenState *states; // indexed by id
+    int *targets;
+    int *cumulative;
+    int state_num;
+    int edge_num;
+    int *starts; // ids of the states a sequence may start from
+    int *start_cumulative; // running sums of their weights, or NULL
+    int start_num;
+    uint32_t *offsets; // NULL unless compacted
+    uint8_t *bytes;
+    size_t byte_num;
+    // targets and cumulative point into the chain's snapshot (see
+    // freeze_mapped_markov_chain), and the states have no counter lists
+    bool mapped;
+} FrozenChain;
+
+/**
+ * State of a random number generator (splitmix64) owned by its caller, so
+ * that generation doesn't share the hidden state of rand().
+ */
+typedef struct MarkovRng
+{
+    uint64_t state;
+} MarkovRng;
+
+/* The first six variables are the original interface of this struct, and
+ * are filled in by its users as before. Every variable after them was added
+ * for the chain's own bookkeeping or as an option, and means "off" or "not
+ * built yet" when it is 0 / NULL, so a chain created with calloc (or with
+ * the original six set and the rest zeroed) behaves as it always did. Keep
+ * it that way when adding a variable: its zero value must be valid. */
 typedef struct MarkovChain
 {
     LinkedList *database;
@@ -73,25 +207,138 @@ typedef struct MarkovChain
     //      - true if it's the last state.
     //      - false otherwise.
     IsLast is_last;
+
+    // a pointer to a function that gets a pointer of generic data type
+    // and returns its hash. Equal data (by comp_func) must have equal hashes.
+    // If NULL, the database is searched linearly.
+    GenHash hash_func;
+
+    // a pointer to a function defined with MARKOV_DEFINE_LOOKUP from
+    // hash_func and comp_func, that searches the hash index without calling
+    // them through pointers. If NULL, the index calls them.
+    GenLookup lookup_func;
+
+    // hash index over the database, built lazily by add_to_database.
+    // Must be NULL when the chain is created.
+    HashIndex *index;
+
+    // a pointer to a function that gets a pointer of generic data type
+    // and returns its size in bytes. If not NULL, the chain stores the data
+    // itself (inside the node or in its arena) instead of calling copy_func,
+    // and never calls free_data on it.
+    GenSize data_size;
+
+    // blocks holding chain owned data that doesn't fit inside a node, built
+    // lazily by add_to_database. Must be NULL when the chain is created.
+    Arena *arena;
+
+    // compact layout built by freeze_markov_chain, NULL while training.
+    // Must be NULL when the chain is created.
+    FrozenChain *frozen;
+
+    // if true, a frozen chain starts sequences at each state in proportion
+    // to how many times it followed a last state in training, instead of
+    // uniformly over all the states that are not last.
+    bool weight_starts;
+
+    // training-time pruning: after every prune_interval calls of
+    // add_node_to_counter_list, the edges seen fewer than prune_below times
+    // so far are dropped (see drop_rare_edges). 0 for no pruning while
+    // training. edges_since_prune counts the calls since the last pass.
+    int prune_below;
+    int prune_interval;
+    int edges_since_prune;
+
+    // state the training so far ended at, which the next text trained on
+    // follows (see train_on_file). Saved and loaded with the chain.
+    MarkovNode *last_state;
+
+    // snapshot file mapped by load_markov_chain, which the data of the
+    // loaded states points into, and the size of the mapping. Must be NULL
+    // when the chain is created.
+    void *snapshot;
+    size_t snapshot_size;
+
+    // slab pools the chain allocates its Node and MarkovNode structs and its
+    // counter lists from (one pool per capacity), created lazily. Freeing
+    // the chain frees them whole. Must be NULL when the chain is created.
+    Pool *list_pool;
+    Pool *node_pool;
+    Pool *counter_pools[COUNTER_CLASSES];
+
+    // the states of the database by id, so that an edge can hold its
+    // successor's id instead of a pointer. Kept by the chain, must be NULL
+    // when the chain is created.
+    MarkovNode **states;
+    int state_capacity;
+
+    // if not NULL, a bit per state id, set when the state's counter list
+    // changes, so that a LiveChain (see live_chain.h) publishes only the
+    // states trained since its last version. Grown as needed while set.
+    uint64_t *dirty;
+    int dirty_words;
 } MarkovChain;
 
 /**
- * Get one random state from the given markov_chain's database.
+ * Get one random state, that is not a last state, from the given
+ * markov_chain's database. A frozen chain draws it from its start states
+ * in O(1) (O(log n) when weight_starts is set).
  * @param markov_chain
- * @return
+ * @return the chosen state, NULL if every state is a last state
  */
 MarkovNode *get_first_random_node (MarkovChain *markov_chain);
 
+/**
+ * Checks if the chain has a state that is not a last state, which
+ * get_first_random_node and generation from no first state need. O(1) on
+ * a frozen chain, a scan of the database otherwise.
+ * @param markov_chain chain
+ * @return true if there is one, false otherwise
+ */
+bool has_start_state (const MarkovChain *markov_chain);
+
 /**
  * Choose randomly the next state, depend on it's occurrence frequency.
- * @param state_struct_ptr MarkovNode to choose from
+ * @param state_struct_ptr MarkovNode to choose from, whose chain resolves
+ * the ids of its successors
  * @return MarkovNode of the chosen state
  */
 MarkovNode *get_next_random_node (MarkovNode *state_struct_ptr);
 
+/**
+ * Like get_next_random_node, with the chain that resolves the ids of the
+ * state's successors given by the caller.
+ * @param markov_chain chain of the state
+ * @param state_struct_ptr MarkovNode to choose from
+ * @return MarkovNode of the chosen state
+ */
+MarkovNode *next_random_node (const MarkovChain *markov_chain,
+                              MarkovNode *state_struct_ptr);
+
+/**
+ * Generates a random sequence into a buffer, without printing it, without
+ * allocating and without writing to the chain or to any global state, so
+ * any number of threads may generate from the same chain at once as long
+ * as none trains it and each has its own generator. The sequence ends after
+ * a last state (see is_last), a state with no successors, or max_length
+ * states. A frozen chain is walked through its frozen layout.
+ * @param markov_chain chain to generate from
+ * @param first_node state to start with, if NULL a random state that is not
+ * a last state is drawn
+ * @param max_length maximum length of the sequence
+ * @param rng generator to draw from. If NULL the sequence is drawn from
+ * rand (), like generate_random_sequence does, which isn't reentrant.
+ * @param sequence filled with the states of the sequence, must have room
+ * for max_length states
+ * @return length of the sequence, 0 if there is no state to start from
+ */
+int generate_sequence (const MarkovChain *markov_chain, MarkovNode *first_node,
+                       int max_length, MarkovRng *rng, MarkovNode **sequence);
+
 /**
  * Receive markov_chain, generate and print random sentence out of it. The
- * sentence most have at least 2 words in it.
+ * sentence most have at least 2 words in it. Generates with
+ * generate_sequence, drawing from rand (), and prints with print_sequence.
  * @param markov_chain
  * @param first_node markov_node to start with, if NULL- choose a random
  * markov_node
@@ -100,12 +347,240 @@ MarkovNode *get_next_random_node (MarkovNode *state_struct_ptr);
 void generate_random_sequence (MarkovChain *markov_chain, MarkovNode *
 first_node, int max_length);
 
+/**
+ * Packs the trained chain into one contiguous array of states and one flat
+ * array of edges (see FrozenChain), which generate_random_sequence then
+ * walks instead of the linked database. Sampling a successor takes
+ * O(log k) for a state with k successors, and draws the same states as
+ * without freezing. Also collects the states sequences may start from (see
+ * weight_starts). Adding states or edges afterwards unfreezes the chain.
+ * Completes a chain loaded onto a mapped snapshot.
+ * @param markov_chain trained chain
+ * @return true on success, false in case of allocation error
+ */
+bool freeze_markov_chain (MarkovChain *markov_chain);
+
+/**
+ * Freezes a chain whose states have no counter lists onto edges it doesn't
+ * own, like those of a mapped snapshot: the edges of the states, in id
+ * order, are back to back in targets and cumulative (see FrozenChain), and
+ * next_node_ctr counts them. Nothing is copied, so generating from the
+ * chain reads the edges where they are, and read_counter_list reads them
+ * from there too. The chain's is_last isn't called yet, as it may need
+ * more than the loaded states: freeze_markov_chain must be called before
+ * generating, and fills which states are last and the start states. Adding
+ * states or edges afterwards copies the edges into counter lists first,
+ * like for a compacted chain.
+ * @param markov_chain chain that isn't frozen
+ * @param targets id of the target of every edge
+ * @param cumulative running sum of the frequencies of each state's edges
+ * @param edge_num number of edges
+ * @return true on success, false in case of allocation error or if the
+ * chain is already frozen
+ */
+bool freeze_mapped_markov_chain (MarkovChain *markov_chain, const int *targets,
+                                 const int *cumulative, int edge_num);
+
+/**
+ * Get random number between 0 and max_number [0, max_number) from a
+ * generator, or from rand () if there is none.
+ * @param rng generator, may be NULL
+ * @param max_number maximal number to return (not including)
+ * @return Random number
+ */
+int draw_number (MarkovRng *rng, int max_number);
+
+/**
+ * Finds the edge a number drawn below a state's total frequency chooses:
+ * the first edge whose running sum is above the number, which is the edge
+ * the linear scan of next_random_node picks.
+ * @param cumulative running sums of the state's edges
+ * @param edge_num number of edges, at least 1
+ * @param i number drawn in [0, cumulative[edge_num - 1])
+ * @return index of the chosen edge
+ */
+int search_cumulative (const int *cumulative, int edge_num, int i);
+
+/**
+ * Freezes the chain into a compact layout that takes a few bytes per edge
+ * (see FrozenChain), for serving chains too big to keep trained: the
+ * counter lists, successor tables, hash index and the arrays of the frozen
+ * layout are released. Counter lists are left NULL, while next_node_ctr
+ * still counts the successors, and read_counter_list decodes them. A
+ * successor is drawn by decoding at most COMPACT_BLOCK edges, with the
+ * same probabilities as before compacting, though a given random number
+ * may choose a different one, as the edges are sorted. Adding states or
+ * edges afterwards decodes the counter lists back.
+ * @param markov_chain trained chain
+ * @return true on success, false in case of allocation error or if the
+ * encoding doesn't fit in 4 GB, in which case the chain is left frozen
+ */
+bool compact_markov_chain (MarkovChain *markov_chain);
+
+/**
+ * Copies the counters of a state's counter list, decoding them if the chain
+ * is compacted, or reading them from the edges a mapped chain is frozen onto.
+ * @param markov_chain chain of the state
+ * @param markov_node state
+ * @param counters filled with its next_node_ctr counters
+ * @return number of counters copied
+ */
+int read_counter_list (const MarkovChain *markov_chain,
+                       const MarkovNode *markov_node,
+                       NextNodeCounter *counters);
+
+/**
+ * Seeds a random number generator. Every (seed, stream) pair gives an
+ * independent sequence of numbers.
+ * @param rng generator to seed
+ * @param seed seed
+ * @param stream number of the stream, e.g. the index of a sequence
+ */
+void seed_markov_rng (MarkovRng *rng, uint64_t seed, uint64_t stream);
+
+/**
+ * Generates sequences first_index .. first_index + sequence_num - 1 out of
+ * a frozen chain using thread_num threads. Sequence i draws its start state
+ * and its transitions from its own generator, seeded with (seed, i), so the
+ * sequences depend only on the seed and their index, not on the number of
+ * threads. Nothing in the chain is modified.
+ * @param markov_chain frozen chain
+ * @param seed seed of the batch
+ * @param first_index index of the first sequence
+ * @param sequence_num number of sequences to generate
+ * @param max_length maximum length of a sequence, at least 2
+ * @param thread_num number of threads, at least 1
+ * @param sequences filled with the states of sequence i at
+ * sequences[i * max_length ...]
+ * @param lengths filled with the length of each sequence, 0 if the chain
+ * has no state to start from
+ * @return true on success, false if the chain is not frozen
+ */
+bool generate_batch (const MarkovChain *markov_chain, uint64_t seed,
+                     uint64_t first_index, int sequence_num, int max_length,
+                     int thread_num, MarkovNode **sequences, int *lengths);
+
+/**
+ * Prints a sequence made by generate_sequence or generate_batch with the
+ * chain's print_func, ending it like generate_random_sequence does when it
+ * reaches max_length: print_func gets a copy of the last node's data and id
+ * with is_last set, the node itself isn't modified (nor read beyond those).
+ * @param markov_chain chain the sequence was generated from
+ * @param sequence states of the sequence
+ * @param length length of the sequence
+ * @param max_length maximum length the sequence was generated with
+ */
+void print_sequence (MarkovChain *markov_chain, MarkovNode **sequence,
+                     int length, int max_length);
+
+/**
+ * Scales every frequency in the chain by numerator / denominator (rounded
+ * down), so that older training weighs less than newer, and reclaims what
+ * no longer counts: edges whose frequency drops to 0 are removed from
+ * their counter_list, and states left with no edges in or out (other than
+ * last_state) are removed from the database and freed, along with their
+ * data. Node ids are renumbered to stay positions in the database. Applied
+ * between training batches, it keeps the chain's memory proportional to
+ * the recent text instead of all the text ever trained on. A live chain
+ * (see live_chain.h) can't be decayed, as its readers may hold its states.
+ * @param markov_chain chain to decay
+ * @param numerator numerator of the factor, at least 0
+ * @param denominator denominator of the factor, above 0
+ * @return true on success, false in case of allocation error or if the
+ * chain is live
+ */
+bool decay_markov_chain (MarkovChain *markov_chain, int numerator,
+                         int denominator);
+
+/**
+ * Training-time pass over the long tail: edges seen fewer than
+ * min_frequency times so far are removed from their counter_list, which
+ * moves to a smaller block when it fits one. Unlike prune_markov_chain, no
+ * state is removed, so the states a trainer holds stay valid, and it can
+ * run between any two add_node_to_counter_list calls. Counts are not final
+ * then: an edge dropped early starts over from 1 if it is seen again, so
+ * only edges frequent within each stretch of training survive, and where
+ * the passes fall (for example, per shard when training with threads)
+ * changes what is kept. A live chain is left as is.
+ * @param markov_chain chain being trained
+ * @param min_frequency minimal frequency of a kept edge
+ * @return true on success, false in case of allocation error
+ */
+bool drop_rare_edges (MarkovChain *markov_chain, int min_frequency);
+
+/**
+ * Prunes the long tail of a trained chain: edges seen fewer than
+ * min_frequency times are removed from their counter_list, then every
+ * state keeps only its max_successors most frequent edges (ties go to the
+ * edges first in the list). States left with no edges in or out are removed
+ * like decay_markov_chain does, and the counter lists are moved to pools
+ * holding nothing else, so that the memory of the removed edges is freed.
+ * The counts are exact until then, so the successors kept are the true top
+ * ones: call it once training is done, after merging any shards (see
+ * drop_rare_edges for pruning while training). A live chain can't be
+ * pruned.
+ * @param markov_chain chain to prune
+ * @param min_frequency minimal frequency of a kept edge, 1 to keep them all
+ * @param max_successors maximal number of successors of a state, 0 for no
+ * maximum
+ * @param reclaimed set to the number of bytes freed (see
+ * markov_chain_memory), not counting the hash index, which the next lookup
+ * rebuilds
+ * @return true on success, false in case of allocation error or if the
+ * chain is live
+ */
+bool prune_markov_chain (MarkovChain *markov_chain, int min_frequency,
+                         int max_successors, size_t *reclaimed);
+
+/**
+ * Returns the number of bytes the chain takes: the pools of its nodes and
+ * counter lists (including released items), its table of states by id and
+ * dirty bits, the data it stores itself, its hash index, frozen (or
+ * compacted) layout and mapped snapshot.
+ * Data copied with copy_func is not counted.
+ * @param markov_chain chain
+ * @return size of the chain in bytes
+ */
+size_t markov_chain_memory (const MarkovChain *markov_chain);
+
 /**
  * Free markov_chain and all of it's content from memory
  * @param markov_chain markov_chain to free
  */
 void free_markov_chain (MarkovChain **markov_chain);
 
+/**
+ * Writes the states of the chain (their data, in database order) and the
+ * frequencies of their counter lists to a binary snapshot file, which
+ * load_markov_chain can map back. Requires a data_size function. The file
+ * uses the byte order of the machine that wrote it. It is written next to
+ * path and renamed over it, so a chain loaded from path can be saved back
+ * to it.
+ * @param markov_chain chain to save
+ * @param path path of the file to write
+ * @return true on success, false if the file couldn't be written
+ */
+bool save_markov_chain (MarkovChain *markov_chain, const char *path);
+
+/**
+ * Loads a snapshot written by save_markov_chain into an empty chain that
+ * has its callbacks set, including data_size, which must stop reading at a
+ * zero byte if it scans the data. The file is memory mapped, the data of
+ * the states points into it and the chain is frozen onto its edges (see
+ * freeze_mapped_markov_chain): loading creates a node per state and reads
+ * the edges once to check them, but allocates and copies nothing per edge.
+ * Once completed by freeze_markov_chain (or compact_markov_chain), the
+ * loaded chain generates the same sequences as the saved one. It can be
+ * trained further, continuing from its last_state, or decayed, which first
+ * copies its edges into counter lists.
+ * @param markov_chain empty chain to load into
+ * @param path path of the snapshot file
+ * @return true on success, false if the file couldn't be read, isn't a
+ * valid snapshot or in case of allocation error. On failure the chain may
+ * hold part of the snapshot, and should be freed.
+ */
+bool load_markov_chain (MarkovChain *markov_chain, const char *path);
+
 /**
  * Add the second markov_node to the counter list of the first markov_node.
  * If already in list, update it's counter value.
@@ -118,9 +593,25 @@ void free_markov_chain (MarkovChain **markov_chain);
 bool add_node_to_counter_list (MarkovNode *first_node, MarkovNode
 *second_node, MarkovChain *markov_chain);
 
+/**
+ * Add the second markov_node to the counter list of the first markov_node
+ * with the given frequency, as if add_node_to_counter_list was called
+ * frequency times.
+ * @param first_node
+ * @param second_node
+ * @param frequency number of times second_node followed first_node
+ * @param markov_chain
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_frequency_to_counter_list (MarkovNode *first_node, MarkovNode
+*second_node, int frequency, MarkovChain *markov_chain);
+
 /**
 * Check if data_ptr is in database. If so, return the markov_node wrapping
- * it in the markov_chain, otherwise return NULL.
+ * it in the markov_chain, otherwise return NULL. Uses the hash index if
+ * add_to_database has built it, and searches the database linearly if not,
+ * so it never changes the chain.
  * @param markov_chain the chain to look in its database
  * @param data_ptr the state to look for
  * @return Pointer to the Node wrapping given state, NULL if state not in
@@ -138,27 +629,32 @@ Node *get_node_from_database (MarkovChain *markov_chain, void *data_ptr);
 Node *add_to_database (MarkovChain *markov_chain, void *data_ptr);
 
 /**
- * Checks if the given string is in the node's counter_list
+ * Checks if the given string is in the node's counter_list, comparing it
+ * with comp_func. Training finds successors by identity instead. As the
+ * counter may be changed through the returned pointer, a frozen or
+ * compacted chain is thawed first, like by add_node_to_counter_list.
  * @param node given node
  * @param str string to look for
  * @return if true, returns the NextNodeCounter of the string, else, returns
- * NULL
+ * NULL, which it also does in case of allocation error
  */
 NextNodeCounter *check_ctr_list (MarkovChain *markov_chain, MarkovNode *node,
                                  void *data);
 
 /**
  * allocates memory for counter_list and adds second node to the first's
- * counter list
+ * counter list, thawing a frozen or compacted chain first
+ * @param markov_chain chain to allocate the counter list from
  * @param first_node Node we want to start a counter list for
  * @param second_node Node to be added to counter list
  * @return true if allocation succeeded, false otherwise
  */
-bool new_node_handle (MarkovNode *first_node, MarkovNode *second_node);
+bool new_node_handle (MarkovChain *markov_chain, MarkovNode *first_node,
+                      MarkovNode *second_node);
 
 /**
- * reallocates memory in counter_list and adds second node to the first's
- * counter list
+ * adds second node to the first's counter list, moving the list to a block
+ * twice as big when it is full. A frozen or compacted chain is thawed first.
  * @param first_node Node who's counter_list needs editing
  * @param second_node Node to be added to counter list
  * @return true if succeeded, false otherwise
@@ -167,11 +663,42 @@ bool extend_node (MarkovChain *markov_chain, MarkovNode *first_node,
                   MarkovNode *second_node);
 
 /**
- * returns the total number of nodes in the counter list
+ * returns the total number of nodes in the counter list, which a compacted
+ * chain's states read from its encoded edges
  * @param state_struct_ptr node we need to know the size of it's counter list
  * @return number of nodes in counter list
  */
 int get_total_nodes (MarkovNode *state_struct_ptr);
 
+/**
+ * Creates a state holding data as is (it isn't copied) and adds it to the
+ * end of the database, without looking for it there first. For filling a
+ * chain whose data is stored elsewhere, like a loaded snapshot.
+ * @param markov_chain chain to add the state to
+ * @param data data of the state
+ * @return the Node of the new state, NULL in case of allocation error
+ */
+Node *append_state (MarkovChain *markov_chain, void *data);
+
+/**
+ * Allocates a counter list able to hold capacity counters from the chain's
+ * pools. It gets room for up to the next power of two counters, and can
+ * grow up to that without moving.
+ * @param markov_chain chain owning the list
+ * @param capacity number of counters, above 0
+ * @return the list, NULL in case of allocation error
+ */
+NextNodeCounter *alloc_counter_list (MarkovChain *markov_chain, int capacity);
+
+/**
+ * Releases a counter list allocated by alloc_counter_list.
+ * @param markov_chain chain owning the list
+ * @param counter_list list to release, may be NULL
+ * @param capacity number of counters in the list, which must have been
+ * allocated with a capacity of the same power of two
+ */
+void free_counter_list (MarkovChain *markov_chain,
+                        NextNodeCounter *counter_list, int capacity);
+
 #endif /* _MARKOV_CHAIN_H */
 
@@ -0,0 +1,41 @@
+#include "ngram.h"
+#include "markov_chain.h"
+#include <string.h>
+
+#define HASH_SEED 0x9e3779b97f4a7c15UL
+#define HASH_MUL 0xff51afd7ed558ccdUL
+#define HASH_SHIFT 32
+
+size_t ngram_size (const void *ngram)
+{
+  return (1 + *(const uint32_t *) ngram) * sizeof (uint32_t);
+}
+
+int ngram_cmp (const void *a, const void *b)
+{
+  if (*(const uint32_t *) a != *(const uint32_t *) b)
+  {
+    return 1;
+  }
+  return memcmp (a, b, ngram_size (a));
+}
+
+unsigned long ngram_hash (const void *ngram)
+{
+  const uint32_t *ids = ngram;
+  unsigned long hash = HASH_SEED;
+  for (uint32_t i = 0; i <= ids[0]; i++)
+  {
+    hash = (hash ^ ids[i]) * HASH_MUL;
+    hash ^= hash >> HASH_SHIFT;
+  }
+  return hash;
+}
+
+uint32_t ngram_last (const void *ngram)
+{
+  const uint32_t *ids = ngram;
+  return ids[ids[0]];
+}
+
+MARKOV_DEFINE_LOOKUP (ngram_lookup, ngram_hash, ngram_cmp)
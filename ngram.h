@@ -0,0 +1,59 @@
+#ifndef _NGRAM_H_
+#define _NGRAM_H_
+#include <stdlib.h> // For size_t
+#include <stdint.h> // For uint32_t
+
+struct Node;
+struct HashIndex;
+
+#define MAX_ORDER 8
+
+/**
+ * State of an order k chain: an array of k + 1 uint32_t, the order k
+ * followed by the ids of the last k tokens, oldest first. Since the order
+ * is part of the state, the functions below are usable as the callbacks
+ * of a chain of any order, and a state of order up to 3 fits inside its
+ * MarkovNode (see MARKOV_INLINE_SIZE).
+ */
+
+/**
+ * Returns the size of an n-gram.
+ * @param ngram n-gram
+ * @return number of bytes the n-gram takes
+ */
+size_t ngram_size (const void *ngram);
+
+/**
+ * Compares two n-grams.
+ * @param a first n-gram
+ * @param b second n-gram
+ * @return 0 if the n-grams are equal, non zero otherwise
+ */
+int ngram_cmp (const void *a, const void *b);
+
+/**
+ * Hashes an n-gram.
+ * @param ngram n-gram to hash
+ * @return hash of the n-gram
+ */
+unsigned long ngram_hash (const void *ngram);
+
+/**
+ * Returns the id of the newest token of an n-gram.
+ * @param ngram n-gram
+ * @return id of its last token
+ */
+uint32_t ngram_last (const void *ngram);
+
+/**
+ * Lookup function (see MARKOV_DEFINE_LOOKUP) of a chain of n-grams, with
+ * ngram_hash and ngram_cmp inlined.
+ * @param index hash index of the chain
+ * @param data n-gram to look for
+ * @param hash_ptr set to the hash of the n-gram
+ * @return the Node holding the n-gram, NULL if there is none
+ */
+struct Node *ngram_lookup (const struct HashIndex *index, const void *data,
+                           unsigned long *hash_ptr);
+
+#endif //_NGRAM_H_
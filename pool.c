@@ -0,0 +1,81 @@
+#include "pool.h"
+
+#define POOL_ALIGN sizeof (void *)
+
+Pool *new_pool (size_t item_size)
+{
+  Pool *pool = malloc (sizeof (Pool));
+  if (pool == NULL)
+  {
+    return NULL;
+  }
+  pool->item_size = (item_size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+  pool->slab_items = pool->item_size < POOL_SLAB_SIZE
+                     ? POOL_SLAB_SIZE / pool->item_size : 1;
+  pool->head = NULL;
+  pool->free_list = NULL;
+  pool->used = 0;
+  pool->slab_num = 0;
+  return pool;
+}
+
+void *pool_alloc (Pool *pool)
+{
+  if (pool->free_list != NULL)
+  {
+    void *item = pool->free_list;
+    pool->free_list = *(void **) item;
+    return item;
+  }
+  if (pool->head == NULL || pool->used == pool->slab_items)
+  {
+    PoolSlab *slab = malloc (sizeof (PoolSlab)
+                             + pool->slab_items * pool->item_size);
+    if (slab == NULL)
+    {
+      return NULL;
+    }
+    slab->next = pool->head;
+    pool->head = slab;
+    pool->used = 0;
+    pool->slab_num++;
+  }
+  return pool->head->bytes + pool->item_size * pool->used++;
+}
+
+void pool_release (Pool *pool, void *item)
+{
+  if (item == NULL)
+  {
+    return;
+  }
+  *(void **) item = pool->free_list;
+  pool->free_list = item;
+}
+
+size_t pool_bytes (const Pool *pool)
+{
+  if (pool == NULL)
+  {
+    return 0;
+  }
+  return sizeof (Pool) + pool->slab_num * (sizeof (PoolSlab)
+                                           + pool->slab_items
+                                             * pool->item_size);
+}
+
+void free_pool (Pool *pool)
+{
+  if (pool == NULL)
+  {
+    return;
+  }
+  PoolSlab *cur = pool->head;
+  while (cur != NULL)
+  {
+    PoolSlab *temp = cur->next;
+    free (cur);
+    cur = temp;
+  }
+  free (pool);
+}
@@ -0,0 +1,61 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+#include <stdlib.h> // For malloc()
+
+#define POOL_SLAB_SIZE 65536
+
+typedef struct PoolSlab {
+    struct PoolSlab *next;
+    char bytes[];
+} PoolSlab;
+
+/**
+ * Slab allocator of items of one fixed size: items are carved back to back
+ * out of large slabs, released items are kept on a free list and handed out
+ * again, and all the slabs are freed together.
+ */
+typedef struct Pool {
+    PoolSlab *head; // slab currently carved from
+    void *free_list; // released items, each starting with the next one
+    size_t item_size;
+    size_t slab_items; // number of items in a slab
+    size_t used; // number of items carved from the head slab
+    size_t slab_num;
+} Pool;
+
+/**
+ * Allocates an empty pool.
+ * @param item_size size of its items in bytes, rounded up to the size of a
+ * pointer. Items bigger than POOL_SLAB_SIZE get a slab each.
+ * @return pointer to the new pool, NULL on allocation failure
+ */
+Pool *new_pool (size_t item_size);
+
+/**
+ * Allocates an item from the pool, aligned to the size of a pointer.
+ * @param pool pool to allocate from
+ * @return pointer to the item, NULL on allocation failure
+ */
+void *pool_alloc (Pool *pool);
+
+/**
+ * Releases an item back to its pool, to be handed out again.
+ * @param pool pool the item was allocated from
+ * @param item item to release, may be NULL
+ */
+void pool_release (Pool *pool, void *item);
+
+/**
+ * Returns the number of bytes the slabs of the pool take.
+ * @param pool pool, may be NULL
+ * @return size of the pool in bytes
+ */
+size_t pool_bytes (const Pool *pool);
+
+/**
+ * Frees the pool and every item allocated from it.
+ * @param pool pool to free, may be NULL
+ */
+void free_pool (Pool *pool);
+
+#endif //_POOL_H_
@@ -1,61 +1,44 @@
 #include <string.h> // For strlen(), strcmp(), strcpy()
 #include "markov_chain.h"
+#include "board.h"
+#include "writer.h"
+#include "stats.h"
+#include "absorbing.h"
 
-#define MAX(X, Y) (((X) < (Y)) ? (Y) : (X))
-
-#define EMPTY -1
-#define BOARD_SIZE 100
 #define MAX_GENERATION_LENGTH 60
 #define RANDOM "Random Walk "
 #define USG_ERR "Usage: number of arguments must be 2."
-
-#define DICE_MAX 6
-#define NUM_OF_TRANSITIONS 20
-
-/**
- * represents the transitions by ladders and snakes in the game
- * each tuple (x,y) represents a ladder from x to if x<y or a snake otherwise
- */
-const int transitions[][2] = {{13, 4},
-                              {85, 17},
-                              {95, 67},
-                              {97, 58},
-                              {66, 89},
-                              {87, 31},
-                              {57, 83},
-                              {91, 25},
-                              {28, 50},
-                              {35, 11},
-                              {8,  30},
-                              {41, 62},
-                              {81, 43},
-                              {69, 32},
-                              {20, 39},
-                              {33, 70},
-                              {79, 99},
-                              {23, 76},
-                              {15, 47},
-                              {61, 14}};
-
-/**
- * struct represents a Cell in the game board
- */
-typedef struct Cell
-{
-    int number; // Cell number 1-100
-    int ladder_to;  // ladder_to represents the jump of the ladder in case
-    // there is one from this square
-    int snake_to;  // snake_to represents the jump of the snake in case
-    // there is one from this square
-    //both ladder_to and snake_to should be -1 if the Cell doesn't have them
-} Cell;
+#define STATS_FLAG "--stats"
+#define TRACE_FLAG "--trace"
+#define EXACT_FLAG "--exact"
+// the distribution of the game lengths is computed up to this many turns
+#define EXACT_MAX_LENGTH 400
+#define EXPECTED_TURNS "Expected turns to cell %d: %.6f\n"
+#define LENGTHS "Game length distribution, in turns:\n"
+#define LENGTH "%d turns: %.9f\n"
+#define LONGER "More than %d turns: %.3g\n"
+#define VISITS "Visit probabilities:\n"
+#define VISIT "Cell %d: %.6f (expected visits %.6f)\n"
+#define TRACE_ERR "Error: Failed to write the trace file.\n"
+#define ARROW " -> "
+#define SNAKE_TO "-snake to "
+#define LADDER_TO "-ladder to "
 
 typedef struct NeededVals
 {
     int seed;
     int length;
+    bool stats;
+    char *trace_path; // Chrome trace of the phases to write, or NULL
+    bool exact; // print the exact statistics of the game
 } NeededVals;
 
+/**
+ * where cell_print writes the walks to. print_func gets nothing but the
+ * node, so main sets it up before generating.
+ */
+static Writer *output = NULL;
+
 /** Error handler **/
 static int handle_error (char *error_msg, MarkovChain **database)
 {
@@ -67,124 +50,6 @@ static int handle_error (char *error_msg, MarkovChain **database)
   return EXIT_FAILURE;
 }
 
-static int create_board (Cell *cells[BOARD_SIZE])
-{
-  for (int i = 0; i < BOARD_SIZE; i++)
-  {
-    cells[i] = malloc (sizeof (Cell));
-    if (cells[i] == NULL)
-    {
-      for (int j = 0; j < i; j++)
-      {
-        free (cells[j]);
-      }
-      handle_error (ALLOCATION_ERROR_MASSAGE, NULL);
-      return EXIT_FAILURE;
-    }
-    *(cells[i]) = (Cell) {i + 1, EMPTY, EMPTY};
-  }
-
-  for (int i = 0; i < NUM_OF_TRANSITIONS; i++)
-  {
-    int from = transitions[i][0];
-    int to = transitions[i][1];
-    if (from < to)
-    {
-      cells[from - 1]->ladder_to = to;
-    }
-    else
-    {
-      cells[from - 1]->snake_to = to;
-    }
-  }
-  return EXIT_SUCCESS;
-}
-
-/**
- * fills database
- * @param markov_chain
- * @return EXIT_SUCCESS or EXIT_FAILURE
- */
-static int fill_database (MarkovChain *markov_chain)
-{
-  Cell *cells[BOARD_SIZE];
-  if (create_board (cells) == EXIT_FAILURE)
-  {
-    return EXIT_FAILURE;
-  }
-  MarkovNode *from_node = NULL, *to_node = NULL;
-  size_t index_to;
-  for (size_t i = 0; i < BOARD_SIZE; i++)
-  {
-    add_to_database (markov_chain, cells[i]);
-  }
-
-  for (size_t i = 0; i < BOARD_SIZE; i++)
-  {
-    from_node = get_node_from_database (markov_chain, cells[i])->data;
-
-    if (cells[i]->snake_to != EMPTY || cells[i]->ladder_to != EMPTY)
-    {
-      index_to = MAX(cells[i]->snake_to, cells[i]->ladder_to) - 1;
-      to_node = get_node_from_database (markov_chain, cells[index_to])
-          ->data;
-      add_node_to_counter_list (from_node, to_node, markov_chain);
-    }
-    else
-    {
-      for (int j = 1; j <= DICE_MAX; j++)
-      {
-        index_to = ((Cell *) (from_node->data))->number + j - 1;
-        if (index_to >= BOARD_SIZE)
-        {
-          break;
-        }
-        to_node = get_node_from_database (markov_chain, cells[index_to])
-            ->data;
-        add_node_to_counter_list (from_node, to_node, markov_chain);
-      }
-    }
-  }
-  // free temp arr
-  for (size_t i = 0; i < BOARD_SIZE; i++)
-  {
-    free (cells[i]);
-  }
-  return EXIT_SUCCESS;
-}
-
-/**
- * copies a cell type and returns the copy
- * @param cell_p cell to be copied
- * @return copied cell
- */
-static void *copy_cell (const void *cell_p)
-{
-  Cell *old_cell = (Cell *) cell_p;
-  Cell *cell = malloc (sizeof (Cell));
-  if (cell == NULL)
-  {
-    return NULL;
-  }
-  cell->ladder_to = old_cell->ladder_to;
-  cell->snake_to = old_cell->snake_to;
-  cell->number = old_cell->number;
-  return cell;
-}
-
-/**
- * compares the number in given cells
- * @param a first cell
- * @param b second cell
- * @return the difference in number betweed cell 1 and 2
- */
-static int cell_cmp (const void *a, const void *b)
-{
-  Cell *cell1 = (Cell *) a;
-  Cell *cell2 = (Cell *) b;
-  return cell1->number - cell2->number;
-}
-
 /**
  * prints the data in cell
  * @param cell_p pointer to the cell
@@ -193,68 +58,35 @@ static void cell_print (const void *cell_p)
 {
   MarkovNode *node = (MarkovNode *) cell_p;
   Cell *cell = node->data;
+  writer_bytes (output, "[", 1);
+  writer_int (output, cell->number);
+  writer_bytes (output, "]", 1);
   if (node->is_last && cell->number != BOARD_SIZE)
   {
-    printf ("[%d] -> \n", cell->number);
+    writer_bytes (output, ARROW "\n", strlen (ARROW "\n"));
   }
   else if (cell->snake_to != EMPTY)
   {
-    printf ("[%d]-snake to %d -> ", cell->number, cell->snake_to);
+    writer_bytes (output, SNAKE_TO, strlen (SNAKE_TO));
+    writer_int (output, cell->snake_to);
+    writer_bytes (output, ARROW, strlen (ARROW));
   }
   else if (cell->ladder_to != EMPTY)
   {
-    printf ("[%d]-ladder to %d -> ", cell->number, cell->ladder_to);
+    writer_bytes (output, LADDER_TO, strlen (LADDER_TO));
+    writer_int (output, cell->ladder_to);
+    writer_bytes (output, ARROW, strlen (ARROW));
   }
   else if (cell->number == BOARD_SIZE)
   {
-    printf ("[%d]\n", cell->number);
+    writer_bytes (output, "\n", 1);
   }
   else
   {
-    printf ("[%d] -> ", cell->number);
+    writer_bytes (output, ARROW, strlen (ARROW));
   }
 }
 
-/**
- * checks if given cell is last in the list
- * @param cell_p pointer to a cell
- * @return true if last cell, false otherwise
- */
-static bool is_last_cell (const void *cell_p)
-{
-  MarkovNode *node = (MarkovNode *) cell_p;
-  Cell *cell = node->data;
-  if (cell->number == BOARD_SIZE || node->is_last)
-  {
-    return true;
-  }
-  return false;
-}
-
-/**
- * frees given cell
- * @param cell_p pointer to cell
- */
-static void cell_free (void *cell_p)
-{
-  MarkovNode *node = (MarkovNode *) cell_p;
-  Cell *cell = node->data;
-  free (cell);
-}
-
-/**
- * fills the chain with functions
- * @param chain markov_chain
- */
-static void set_chain (MarkovChain *chain)
-{
-  chain->copy_func = copy_cell;
-  chain->comp_func = cell_cmp;
-  chain->print_func = cell_print;
-  chain->is_last = is_last_cell;
-  chain->free_data = cell_free;
-}
-
 /**
  * initiates the linked list
  * @return pointer to initiated linked list
@@ -273,30 +105,90 @@ static LinkedList *init_linked_l (void)
 }
 
 /**
- * handles user input
+ * handles user input. Flags may appear anywhere among the arguments.
  * @param argc number of args
- * @param argv given args
+ * @param argv given args: seed, sentence number, and the optional flags
+ * --stats to print where the time went to stderr, --trace PATH to write
+ * the phases as a Chrome trace and --exact to print the exact statistics of
+ * the game after the walks
  * @return seed and sentence number
  */
 static NeededVals handle_input (int argc, char *argv[])
 {
-  if (argc != 3)
+  NeededVals ret = {0, 0, false, NULL, false};
+  char *args[2];
+  int arg_num = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp (argv[i], STATS_FLAG) == 0)
+    {
+      ret.stats = true;
+    }
+    else if (strcmp (argv[i], EXACT_FLAG) == 0)
+    {
+      ret.exact = true;
+    }
+    else if (strcmp (argv[i], TRACE_FLAG) == 0 && i + 1 < argc)
+    {
+      ret.trace_path = argv[++i];
+    }
+    else if (arg_num++ < 2)
+    {
+      args[arg_num - 1] = argv[i];
+    }
+  }
+  if (arg_num != 2)
   {
     printf (USG_ERR);
-    NeededVals ret = {0,0};
-    return ret;
+    return (NeededVals) {0, 0, false, NULL, false};
   }
-  int seed, sent_num;
-  sscanf (argv[1], "%d", &seed);
-  sscanf (argv[2], "%d", &sent_num);
-  NeededVals ret = {seed, sent_num};
+  sscanf (args[0], "%d", &ret.seed);
+  sscanf (args[1], "%d", &ret.length);
   return ret;
 }
 
+/**
+ * prints the exact statistics of games from the first cell: the expected
+ * number of turns, the distribution of the number of turns and the
+ * probability of visiting each cell, solved from the chain's counts. A
+ * snake or a ladder is taken within the turn that got the player to it.
+ * @param chain frozen chain of the board
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int print_exact (MarkovChain *chain)
+{
+  AbsorbingStats *stats = solve_absorbing_chain (
+      chain, chain->database->first->data, is_jump_cell, EXACT_MAX_LENGTH);
+  if (stats == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+  printf (EXPECTED_TURNS, BOARD_SIZE, stats->expected_steps);
+  printf (LENGTHS);
+  for (int t = 0; t <= stats->max_length; t++)
+  {
+    if (stats->length_probs[t] > 0)
+    {
+      printf (LENGTH, t, stats->length_probs[t]);
+    }
+  }
+  printf (LONGER, stats->max_length, stats->unfinished);
+  printf (VISITS);
+  for (Node *cur = chain->database->first; cur != NULL; cur = cur->next)
+  {
+    int id = cur->data->id;
+    printf (VISIT, ((Cell *) cur->data->data)->number,
+            stats->visit_probs[id], stats->expected_visits[id]);
+  }
+  free_absorbing_stats (&stats);
+  return EXIT_SUCCESS;
+}
+
 /**
  * @param argc num of arguments
  * @param argv 1) Seed
  *             2) Number of sentences to generate
+ *             and optionally --stats, --trace PATH and --exact
  * @return EXIT_SUCCESS or EXIT_FAILURE
  */
 int main (int argc, char *argv[])
@@ -307,7 +199,11 @@ int main (int argc, char *argv[])
   {
     return EXIT_FAILURE;
   }
-  MarkovChain *chain = malloc (sizeof (MarkovChain));
+  if (need.stats || need.trace_path != NULL)
+  {
+    stats_enable ();
+  }
+  MarkovChain *chain = calloc (1, sizeof (MarkovChain));
   if (chain == NULL)
   {
     return EXIT_FAILURE;
@@ -319,24 +215,66 @@ int main (int argc, char *argv[])
     return EXIT_FAILURE;
   }
   chain->database = linked;
-  set_chain (chain);
-  int suc = fill_database (chain);
+  set_board_chain (chain);
+  chain->print_func = cell_print;
+  stats_begin ("training");
+  int suc = fill_board_database (chain);
   if (suc == EXIT_FAILURE)
   {
     free (linked);
     free (chain);
     return EXIT_FAILURE;
   }
+  if (freeze_markov_chain (chain) == false)
+  {
+    free_markov_chain (&chain);
+    return EXIT_FAILURE;
+  }
+  stats_end ();
+  output = new_writer (stdout, WRITER_CAPACITY);
+  if (output == NULL)
+  {
+    return handle_error (ALLOCATION_ERROR_MASSAGE, &chain);
+  }
+  stats_begin ("generation");
   srand (seed);
   int i = 1;
   while (sent_num >= i)
   {
-    printf (RANDOM);
-    printf ("%d: ", i);
+    writer_bytes (output, RANDOM, strlen (RANDOM));
+    writer_int (output, i);
+    writer_bytes (output, ": ", 2);
     generate_random_sequence (chain, chain->database->first->data,
                               MAX_GENERATION_LENGTH);
     i++;
   }
+  if (free_writer (output) == false)
+  {
+    return handle_error ("", &chain);
+  }
+  stats_end ();
+  if (need.exact)
+  {
+    stats_begin ("analysis");
+    suc = print_exact (chain);
+    stats_end ();
+    if (suc == EXIT_FAILURE)
+    {
+      return handle_error ("", &chain);
+    }
+  }
+  stats_chain (chain);
+  stats_begin ("teardown");
   free_markov_chain (&chain);
+  stats_end ();
+  if (need.stats)
+  {
+    print_stats (stderr);
+  }
+  if (need.trace_path != NULL && write_trace (need.trace_path) == false)
+  {
+    printf (TRACE_ERR);
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
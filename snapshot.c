@@ -0,0 +1,418 @@
+#define _DEFAULT_SOURCE // For mmap(), MAP_ANONYMOUS
+#include "markov_chain.h"
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <stddef.h> // For offsetof()
+#include <stdio.h> // For rename()
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h> // For close()
+
+/**
+ * Snapshot file layout, all sections 8 byte aligned:
+ *   SnapshotHeader
+ *   SnapshotState[state_num], in database order
+ *   int targets[edge_num] and int cumulative[edge_num], the edges of every
+ *     state back to back, as in a FrozenChain
+ *   data_bytes bytes of state data, each padded to a multiple of 8 bytes
+ * A loaded chain is frozen onto the mapped edges (see
+ * freeze_mapped_markov_chain), so loading creates the states but copies no
+ * edge. Versions 1 and 2 have SnapshotEdge[edge_num] instead, the same
+ * size, which are still loaded by copying them into counter lists. Version
+ * 1 headers end before last_state.
+ * The file is mapped followed by at least one page of zeros, so a data_size
+ * function that stops at a zero byte, as string ones do, can't read past the
+ * mapping even on a corrupt record, whose size is then checked against the
+ * data section.
+ */
+#define SNAPSHOT_MAGIC "MKVC"
+#define SNAPSHOT_MAGIC_LEN 4
+#define SNAPSHOT_VERSION 3
+#define EDGE_PAIRS_VERSION 2 // the last version with SnapshotEdge
+#define SNAPSHOT_ALIGN 8
+#define NO_STATE UINT32_MAX
+#define TEMP_SUFFIX ".tmp"
+
+typedef struct SnapshotHeader
+{
+    char magic[SNAPSHOT_MAGIC_LEN];
+    uint32_t version;
+    uint32_t state_num;
+    uint32_t edge_num;
+    uint64_t data_bytes;
+    uint32_t last_state; // id of the chain's last_state, or NO_STATE
+    uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct SnapshotState
+{
+    uint64_t data_offset; // from the start of the data section
+    uint32_t first_edge;
+    uint32_t edge_num;
+} SnapshotState;
+
+// an edge of a version 1 or 2 snapshot
+typedef struct SnapshotEdge
+{
+    uint32_t target; // id of the target state
+    uint32_t frequency;
+} SnapshotEdge;
+
+/**
+ * rounds a size up to SNAPSHOT_ALIGN
+ * @param size size in bytes
+ * @return the padded size
+ */
+static uint64_t padded (uint64_t size)
+{
+  return (size + SNAPSHOT_ALIGN - 1) & ~(uint64_t) (SNAPSHOT_ALIGN - 1);
+}
+
+/**
+ * returns the size of the header of a snapshot
+ * @param header header of a snapshot
+ * @return its size in bytes, which depends on its version
+ */
+static uint64_t header_size (const SnapshotHeader *header)
+{
+  return header->version == 1 ? offsetof (SnapshotHeader, last_state)
+                              : sizeof (SnapshotHeader);
+}
+
+/**
+ * writes the three sections of the snapshot that follow the header
+ * @param markov_chain chain to save
+ * @param fp file to write to
+ * @return true on success, false on write error
+ */
+static bool write_sections (MarkovChain *markov_chain, FILE *fp)
+{
+  LinkedList *database = markov_chain->database;
+  uint64_t data_offset = 0;
+  uint32_t first_edge = 0;
+  for (Node *cur = database->first; cur != NULL; cur = cur->next)
+  {
+    SnapshotState state = {data_offset, first_edge,
+                           (uint32_t) cur->data->next_node_ctr};
+    if (fwrite (&state, sizeof (state), 1, fp) != 1)
+    {
+      return false;
+    }
+    data_offset += padded (markov_chain->data_size (cur->data->data));
+    first_edge += state.edge_num;
+  }
+  // a compacted chain's counter lists are decoded one state at a time
+  int max_edges = 0;
+  for (Node *cur = database->first; cur != NULL; cur = cur->next)
+  {
+    if (cur->data->next_node_ctr > max_edges)
+    {
+      max_edges = cur->data->next_node_ctr;
+    }
+  }
+  NextNodeCounter *counters = malloc ((max_edges + 1)
+                                      * sizeof (NextNodeCounter));
+  if (counters == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  // the targets of all the edges, then their running sums
+  for (int pass = 0; pass < 2; pass++)
+  {
+    for (Node *cur = database->first; cur != NULL; cur = cur->next)
+    {
+      int edge_num = read_counter_list (markov_chain, cur->data, counters);
+      int sum = 0;
+      for (int i = 0; i < edge_num; i++)
+      {
+        sum += counters[i].frequency;
+        int value = pass == 0 ? counters[i].id : sum;
+        if (fwrite (&value, sizeof (value), 1, fp) != 1)
+        {
+          free (counters);
+          return false;
+        }
+      }
+    }
+  }
+  free (counters);
+  static const char padding[SNAPSHOT_ALIGN];
+  for (Node *cur = database->first; cur != NULL; cur = cur->next)
+  {
+    size_t size = markov_chain->data_size (cur->data->data);
+    if (fwrite (cur->data->data, 1, size, fp) != size
+        || fwrite (padding, 1, padded (size) - size, fp) != padded (size) - size)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool save_markov_chain (MarkovChain *markov_chain, const char *path)
+{
+  SnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION,
+                           (uint32_t) markov_chain->database->size, 0, 0,
+                           NO_STATE, 0};
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    header.edge_num += cur->data->next_node_ctr;
+    header.data_bytes += padded (markov_chain->data_size (cur->data->data));
+  }
+  if (markov_chain->last_state != NULL)
+  {
+    header.last_state = (uint32_t) markov_chain->last_state->id;
+  }
+  // the chain may point into a mapped snapshot at path, which must stay
+  // intact until the new one replaces it
+  char *temp_path = malloc (strlen (path) + strlen (TEMP_SUFFIX) + 1);
+  if (temp_path == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  strcpy (temp_path, path);
+  strcat (temp_path, TEMP_SUFFIX);
+  FILE *fp = fopen (temp_path, "wb");
+  if (fp == NULL)
+  {
+    free (temp_path);
+    return false;
+  }
+  bool suc = fwrite (&header, sizeof (header), 1, fp) == 1
+             && write_sections (markov_chain, fp);
+  suc = fclose (fp) == 0 && suc;
+  suc = suc && rename (temp_path, path) == 0;
+  if (suc == false)
+  {
+    remove (temp_path);
+  }
+  free (temp_path);
+  return suc;
+}
+
+/**
+ * maps a whole file read only, followed by at least one page of zeros
+ * @param path path of the file
+ * @param size set to the size of the file
+ * @param map_size set to the size of the mapping
+ * @return the mapping, NULL on failure
+ */
+static void *map_file (const char *path, size_t *size, size_t *map_size)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat (fd, &st) == 0
+      && st.st_size >= (off_t) offsetof (SnapshotHeader, last_state))
+  {
+    // the file is mapped over a zeroed region one page longer, and the rest
+    // of its last page reads as zeros too
+    *size = st.st_size;
+    *map_size = *size + (size_t) sysconf (_SC_PAGESIZE);
+    map = mmap (NULL, *map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map != MAP_FAILED
+        && mmap (map, *size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+           == MAP_FAILED)
+    {
+      munmap (map, *map_size);
+      map = MAP_FAILED;
+    }
+  }
+  close (fd);
+  return map == MAP_FAILED ? NULL : map;
+}
+
+/**
+ * checks that a mapped file is a snapshot whose sections fit in it
+ * @param map mapped file
+ * @param size size of the file
+ * @return true if the snapshot is valid, false otherwise
+ */
+static bool check_header (const char *map, size_t size)
+{
+  const SnapshotHeader *header = (const SnapshotHeader *) map;
+  return memcmp (header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) == 0
+         && header->version >= 1 && header->version <= SNAPSHOT_VERSION
+         && header_size (header) <= size
+         && header->state_num <= INT_MAX && header->edge_num <= INT_MAX
+         && (header->version == 1 || header->last_state == NO_STATE
+             || header->last_state < header->state_num)
+         && header_size (header)
+            + (uint64_t) header->state_num * sizeof (SnapshotState)
+            + (uint64_t) header->edge_num * sizeof (SnapshotEdge)
+            + header->data_bytes == size;
+}
+
+/**
+ * creates the nodes of the snapshot's states and adds them to the database
+ * @param markov_chain empty chain
+ * @param map mapped snapshot
+ * @param nodes filled with the created nodes, by id
+ * @return true on success, false on allocation failure or invalid state
+ */
+static bool load_states (MarkovChain *markov_chain, const char *map,
+                         MarkovNode **nodes)
+{
+  const SnapshotHeader *header = (const SnapshotHeader *) map;
+  const SnapshotState *states = (const SnapshotState *) (map + header_size (
+      header));
+  const char *data = map + header_size (header)
+                     + header->state_num * sizeof (SnapshotState)
+                     + header->edge_num * sizeof (SnapshotEdge);
+  for (uint32_t i = 0; i < header->state_num; i++)
+  {
+    // the record must start and end inside the data section
+    uint64_t offset = states[i].data_offset;
+    if (offset >= header->data_bytes
+        || markov_chain->data_size (data + offset)
+           > header->data_bytes - offset)
+    {
+      return false;
+    }
+    Node *node = append_state (markov_chain, (void *) (data + offset));
+    if (node == NULL)
+    {
+      printf (ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+    nodes[i] = node->data;
+  }
+  return true;
+}
+
+/**
+ * checks the edges of a snapshot of the current version and freezes the
+ * loaded nodes onto them where they are mapped
+ * @param markov_chain chain the nodes were loaded into
+ * @param map mapped snapshot
+ * @param nodes loaded nodes, by id
+ * @return true on success, false on allocation failure or invalid edge
+ */
+static bool load_mapped_edges (MarkovChain *markov_chain, const char *map,
+                               MarkovNode **nodes)
+{
+  const SnapshotHeader *header = (const SnapshotHeader *) map;
+  const SnapshotState *states = (const SnapshotState *) (map + header_size (
+      header));
+  const int *targets = (const int *) (states + header->state_num);
+  const int *cumulative = targets + header->edge_num;
+  uint32_t edge = 0;
+  for (uint32_t i = 0; i < header->state_num; i++)
+  {
+    uint32_t num = states[i].edge_num;
+    if (states[i].first_edge != edge || num > header->edge_num - edge)
+    {
+      return false;
+    }
+    int prev = 0;
+    for (uint32_t e = edge; e < edge + num; e++)
+    {
+      if (targets[e] < 0 || (uint32_t) targets[e] >= header->state_num
+          || cumulative[e] <= prev)
+      {
+        return false;
+      }
+      prev = cumulative[e];
+    }
+    nodes[i]->next_node_ctr = (int) num;
+    edge += num;
+  }
+  return edge == header->edge_num
+         && freeze_mapped_markov_chain (markov_chain, targets, cumulative,
+                                        (int) header->edge_num);
+}
+
+/**
+ * fills the counter lists of the loaded nodes from the edges of a version 1
+ * or 2 snapshot
+ * @param markov_chain chain the nodes were loaded into
+ * @param map mapped snapshot
+ * @param nodes loaded nodes, by id
+ * @return true on success, false on allocation failure or invalid edge
+ */
+static bool load_edges (MarkovChain *markov_chain, const char *map,
+                        MarkovNode **nodes)
+{
+  const SnapshotHeader *header = (const SnapshotHeader *) map;
+  const SnapshotState *states = (const SnapshotState *) (map + header_size (
+      header));
+  const SnapshotEdge *edges = (const SnapshotEdge *) (states
+                                                      + header->state_num);
+  for (uint32_t i = 0; i < header->state_num; i++)
+  {
+    uint32_t first = states[i].first_edge, num = states[i].edge_num;
+    if (num == 0)
+    {
+      continue;
+    }
+    if (first > header->edge_num || num > header->edge_num - first)
+    {
+      return false;
+    }
+    nodes[i]->counter_list = alloc_counter_list (markov_chain, (int) num);
+    if (nodes[i]->counter_list == NULL)
+    {
+      printf (ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+    for (uint32_t e = 0; e < num; e++)
+    {
+      const SnapshotEdge *edge = &edges[first + e];
+      if (edge->target >= header->state_num || edge->frequency == 0
+          || edge->frequency > INT_MAX)
+      {
+        return false;
+      }
+      nodes[i]->counter_list[e].id = (int) edge->target;
+      nodes[i]->counter_list[e].frequency = (int) edge->frequency;
+      nodes[i]->next_node_ctr++;
+    }
+  }
+  return true;
+}
+
+bool load_markov_chain (MarkovChain *markov_chain, const char *path)
+{
+  if (markov_chain->database->size != 0 || markov_chain->data_size == NULL)
+  {
+    return false;
+  }
+  size_t size = 0, map_size = 0;
+  char *map = map_file (path, &size, &map_size);
+  if (map == NULL)
+  {
+    return false;
+  }
+  if (check_header (map, size) == false)
+  {
+    munmap (map, map_size);
+    return false;
+  }
+  markov_chain->snapshot = map;
+  markov_chain->snapshot_size = map_size;
+  const SnapshotHeader *header = (const SnapshotHeader *) map;
+  MarkovNode **nodes = malloc ((header->state_num + 1) * sizeof (MarkovNode *));
+  if (nodes == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  bool suc = load_states (markov_chain, map, nodes)
+             && (header->version > EDGE_PAIRS_VERSION
+                 ? load_mapped_edges (markov_chain, map, nodes)
+                 : load_edges (markov_chain, map, nodes));
+  if (suc && header->version != 1 && header->last_state != NO_STATE)
+  {
+    markov_chain->last_state = nodes[header->last_state];
+  }
+  free (nodes);
+  return suc;
+}
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 199309L // For clock_gettime()
+#include "stats.h"
+#include "markov_chain.h"
+#include <string.h>
+#include <time.h>
+
+#define MAX_SPANS 256
+#define MAX_PHASE_SPANS 16
+#define MAX_PHASES 32
+#define MAX_DEPTH 16
+#define NANO 1e9
+#define MICRO 1e6
+
+typedef struct Span
+{
+    const char *phase;
+    double start; // seconds since stats_enable
+    double duration;
+} Span;
+
+typedef struct Phase
+{
+    const char *name;
+    double total; // seconds, over every time it was timed
+    int span_num; // spans of it kept for the trace
+} Phase;
+
+typedef struct OpenPhase
+{
+    int phase; // index in phases, -1 if it isn't timed
+    int span; // index in spans, -1 if it isn't kept for the trace
+    double start;
+} OpenPhase;
+
+MarkovStats markov_stats;
+
+static bool enabled = false;
+static double origin = 0;
+static Span spans[MAX_SPANS];
+static int span_num = 0;
+static Phase phases[MAX_PHASES]; // in the order they were first timed
+static int phase_num = 0;
+static OpenPhase open_phases[MAX_DEPTH]; // the phases not ended yet
+static int depth = 0;
+
+static struct
+{
+    int state_num;
+    long edge_num;
+    int max_counters;
+    size_t bytes;
+    bool recorded;
+} shape;
+
+/**
+ * @return monotonic time in seconds
+ */
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / NANO;
+}
+
+void stats_enable (void)
+{
+  enabled = true;
+  origin = now ();
+}
+
+bool stats_enabled (void)
+{
+  return enabled;
+}
+
+/**
+ * finds a phase, adding it the first time it is timed
+ * @param name name of the phase
+ * @return its index in phases, -1 if there is no room for it
+ */
+static int find_phase (const char *name)
+{
+  for (int i = 0; i < phase_num; i++)
+  {
+    if (strcmp (phases[i].name, name) == 0)
+    {
+      return i;
+    }
+  }
+  if (phase_num == MAX_PHASES)
+  {
+    return -1;
+  }
+  phases[phase_num] = (Phase) {name, 0, 0};
+  return phase_num++;
+}
+
+void stats_begin (const char *phase)
+{
+  if (enabled == false || depth == MAX_DEPTH)
+  {
+    return;
+  }
+  OpenPhase *open = &open_phases[depth++];
+  open->phase = find_phase (phase);
+  open->span = -1;
+  open->start = now () - origin;
+  // a phase timed over and over, like reading a stream chunk by chunk,
+  // keeps only its first spans for the trace, but adds up all of them
+  if (open->phase >= 0 && span_num < MAX_SPANS
+      && phases[open->phase].span_num < MAX_PHASE_SPANS)
+  {
+    phases[open->phase].span_num++;
+    spans[span_num] = (Span) {phase, open->start, 0};
+    open->span = span_num++;
+  }
+}
+
+void stats_end (void)
+{
+  if (enabled == false || depth == 0)
+  {
+    return;
+  }
+  OpenPhase *open = &open_phases[--depth];
+  double duration = now () - origin - open->start;
+  if (open->phase >= 0)
+  {
+    phases[open->phase].total += duration;
+  }
+  if (open->span >= 0)
+  {
+    spans[open->span].duration = duration;
+  }
+}
+
+void stats_chain (const MarkovChain *markov_chain)
+{
+  shape.state_num = markov_chain->database->size;
+  shape.edge_num = 0;
+  shape.max_counters = 0;
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    int counters = cur->data->next_node_ctr;
+    shape.edge_num += counters;
+    if (counters > shape.max_counters)
+    {
+      shape.max_counters = counters;
+    }
+  }
+  shape.bytes = markov_chain_memory (markov_chain);
+  shape.recorded = true;
+}
+
+/**
+ * divides two counts
+ * @return a / b, 0 if b is 0
+ */
+static double ratio (double a, double b)
+{
+  return b == 0 ? 0 : a / b;
+}
+
+void print_stats (FILE *fp)
+{
+  fprintf (fp, "%-24s %12s\n", "phase", "seconds");
+  for (int i = 0; i < phase_num; i++)
+  {
+    fprintf (fp, "%-24s %12.6f\n", phases[i].name, phases[i].total);
+  }
+  if (shape.recorded)
+  {
+    fprintf (fp, "%-24s %12d\n", "states", shape.state_num);
+    fprintf (fp, "%-24s %12ld\n", "edges", shape.edge_num);
+    fprintf (fp, "%-24s %12.2f\n", "counter_list avg",
+             ratio (shape.edge_num, shape.state_num));
+    fprintf (fp, "%-24s %12d\n", "counter_list max", shape.max_counters);
+    fprintf (fp, "%-24s %12zu\n", "bytes", shape.bytes);
+  }
+#ifdef MARKOV_STATS
+  const MarkovStats *s = &markov_stats;
+  fprintf (fp, "%-24s %12lu\n", "lookups", s->lookups);
+  fprintf (fp, "%-24s %12.2f\n", "comp_func per lookup",
+           ratio (s->lookup_comparisons, s->lookups));
+  fprintf (fp, "%-24s %12lu\n", "counter_list searches", s->counter_searches);
+  fprintf (fp, "%-24s %12.2f\n", "counters per search",
+           ratio (s->counter_comparisons, s->counter_searches));
+  fprintf (fp, "%-24s %12lu\n", "counter_list moves", s->counter_moves);
+  fprintf (fp, "%-24s %12lu\n", "first state draws", s->start_draws);
+  fprintf (fp, "%-24s %12lu\n", "first state retries", s->start_retries);
+#else
+  fprintf (fp, "hot path counters not compiled in, build with -DMARKOV_STATS\n");
+#endif
+}
+
+bool write_trace (const char *path)
+{
+  FILE *fp = fopen (path, "w");
+  if (fp == NULL)
+  {
+    return false;
+  }
+  fprintf (fp, "{\"traceEvents\":[");
+  for (int i = 0; i < span_num; i++)
+  {
+    fprintf (fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                 "\"ts\":%.3f,\"dur\":%.3f}", i == 0 ? "" : ",",
+             spans[i].phase, spans[i].start * MICRO,
+             spans[i].duration * MICRO);
+  }
+  fprintf (fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  return fclose (fp) == 0;
+}
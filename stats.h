@@ -0,0 +1,82 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+#include <stdio.h>  // For FILE
+#include <stdbool.h> // for bool
+
+/**
+ * Counters of the hot paths of the chain. They are only compiled in when
+ * building with -DMARKOV_STATS: otherwise STATS_ADD expands to nothing and
+ * the counters stay 0. Counting is atomic, so training threads may share
+ * them.
+ */
+typedef struct MarkovStats
+{
+    unsigned long lookups; // searches of a database for some data
+    unsigned long lookup_comparisons; // comp_func calls made by lookups
+    unsigned long counter_searches; // searches of a counter_list
+    unsigned long counter_comparisons; // counters they compared
+    unsigned long counter_moves; // counter_list moves to a bigger block
+    unsigned long start_draws; // draws of a first state
+    unsigned long start_retries; // draws that got a last state and retried
+} MarkovStats;
+
+extern MarkovStats markov_stats;
+
+#ifdef MARKOV_STATS
+#define STATS_ADD(counter, n) \
+  ((void) __atomic_fetch_add (&markov_stats.counter, (n), __ATOMIC_RELAXED))
+#else
+#define STATS_ADD(counter, n) ((void) 0)
+#endif
+
+struct MarkovChain;
+
+/**
+ * Starts timing phases: until this is called, stats_begin and stats_end do
+ * nothing.
+ */
+void stats_enable (void);
+
+/**
+ * @return true if stats_enable was called, for work only worth doing when
+ * the phases are timed
+ */
+bool stats_enabled (void);
+
+/**
+ * Starts timing a phase. Phases may nest, and a phase may be timed more
+ * than once, in which case its times add up.
+ * @param phase name of the phase, a string literal
+ */
+void stats_begin (const char *phase);
+
+/**
+ * Ends the phase started last.
+ */
+void stats_end (void);
+
+/**
+ * Records the shape of a chain for print_stats: its number of states and
+ * edges, the average and maximal length of its counter lists and its size
+ * in bytes. Call it before the chain is freed.
+ * @param markov_chain chain
+ */
+void stats_chain (const struct MarkovChain *markov_chain);
+
+/**
+ * Prints the time of every phase, the recorded shape of the chain and the
+ * counters.
+ * @param fp file to print to
+ */
+void print_stats (FILE *fp);
+
+/**
+ * Writes the timed phases as a Chrome trace (JSON trace event format),
+ * which chrome://tracing and Perfetto can open. Only the first few times a
+ * phase is timed appear in it, though print_stats adds up all of them.
+ * @param path path of the file to write
+ * @return true on success, false if the file couldn't be written
+ */
+bool write_trace (const char *path);
+
+#endif //_STATS_H_
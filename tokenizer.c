@@ -0,0 +1,242 @@
+#include "tokenizer.h"
+#include <stdint.h>
+
+#define UTF8_MAX 0x10FFFF
+#define SURROGATE_FIRST 0xD800
+#define SURROGATE_LAST 0xDFFF
+#define ASCII_CASE_BIT 0x20
+
+/**
+ * The vector operations the scanning loops are written with, on the widest
+ * registers the compiler targets. Without SSE2 (or AVX2) only the scalar
+ * loops are compiled.
+ */
+#if defined (__AVX2__)
+#include <immintrin.h>
+#define TOKENIZER_SIMD 32
+typedef __m256i Vec;
+#define vec_load(p) _mm256_loadu_si256 ((const Vec *) (p))
+#define vec_store(p, v) _mm256_storeu_si256 ((Vec *) (p), (v))
+#define vec_set(c) _mm256_set1_epi8 ((char) (c))
+#define vec_eq(a, b) _mm256_cmpeq_epi8 ((a), (b))
+#define vec_or(a, b) _mm256_or_si256 ((a), (b))
+#define vec_and(a, b) _mm256_and_si256 ((a), (b))
+#define vec_add(a, b) _mm256_add_epi8 ((a), (b))
+#define vec_sub(a, b) _mm256_sub_epi8 ((a), (b))
+#define vec_min(a, b) _mm256_min_epu8 ((a), (b))
+#define vec_mask(v) ((uint32_t) _mm256_movemask_epi8 (v))
+#define VEC_FULL_MASK 0xFFFFFFFFu
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#define TOKENIZER_SIMD 16
+typedef __m128i Vec;
+#define vec_load(p) _mm_loadu_si128 ((const Vec *) (p))
+#define vec_store(p, v) _mm_storeu_si128 ((Vec *) (p), (v))
+#define vec_set(c) _mm_set1_epi8 ((char) (c))
+#define vec_eq(a, b) _mm_cmpeq_epi8 ((a), (b))
+#define vec_or(a, b) _mm_or_si128 ((a), (b))
+#define vec_and(a, b) _mm_and_si128 ((a), (b))
+#define vec_add(a, b) _mm_add_epi8 ((a), (b))
+#define vec_sub(a, b) _mm_sub_epi8 ((a), (b))
+#define vec_min(a, b) _mm_min_epu8 ((a), (b))
+#define vec_mask(v) ((uint32_t) _mm_movemask_epi8 (v))
+#define VEC_FULL_MASK 0xFFFFu
+#endif
+
+#ifdef TOKENIZER_SIMD
+/**
+ * marks the bytes of a vector in [low, low + span]
+ * @param v bytes
+ * @param low first byte of the range
+ * @param span size of the range - 1
+ * @return 0xFF for the bytes in the range, 0 for the others
+ */
+static Vec vec_in_range (Vec v, int low, int span)
+{
+  Vec d = vec_sub (v, vec_set (low));
+  return vec_eq (vec_min (d, vec_set (span)), d);
+}
+
+/**
+ * marks the delimiters of a vector (see is_token_delim)
+ * @param v bytes
+ * @return bit i set if byte i is a delimiter
+ */
+static uint32_t delim_mask (Vec v)
+{
+  Vec delims = vec_or (vec_in_range (v, '\t', '\r' - '\t'),
+                       vec_or (vec_eq (v, vec_set (' ')),
+                               vec_eq (v, vec_set (0))));
+  return vec_mask (delims);
+}
+#endif
+
+const char *skip_token (const char *cur, const char *end)
+{
+#ifdef TOKENIZER_SIMD
+  while (end - cur >= TOKENIZER_SIMD)
+  {
+    uint32_t mask = delim_mask (vec_load (cur));
+    if (mask != 0)
+    {
+      return cur + __builtin_ctz (mask);
+    }
+    cur += TOKENIZER_SIMD;
+  }
+#endif
+  while (cur < end && is_token_delim (*cur) == false)
+  {
+    cur++;
+  }
+  return cur;
+}
+
+const char *skip_delims (const char *cur, const char *end)
+{
+#ifdef TOKENIZER_SIMD
+  while (end - cur >= TOKENIZER_SIMD)
+  {
+    uint32_t mask = ~delim_mask (vec_load (cur)) & VEC_FULL_MASK;
+    if (mask != 0)
+    {
+      return cur + __builtin_ctz (mask);
+    }
+    cur += TOKENIZER_SIMD;
+  }
+#endif
+  while (cur < end && is_token_delim (*cur))
+  {
+    cur++;
+  }
+  return cur;
+}
+
+/**
+ * returns the length of the UTF-8 sequence a byte starts, and the bits of
+ * the code point it holds
+ * @param c first byte of the sequence
+ * @param bits set to the bits of the code point in c
+ * @param min set to the smallest code point the sequence may encode
+ * @return 1 to 4, 0 if c can't start a sequence
+ */
+static int sequence_length (unsigned char c, uint32_t *bits, uint32_t *min)
+{
+  if (c < 0x80)
+  {
+    *bits = c;
+    *min = 0;
+    return 1;
+  }
+  if ((c & 0xE0) == 0xC0)
+  {
+    *bits = c & 0x1F;
+    *min = 0x80;
+    return 2;
+  }
+  if ((c & 0xF0) == 0xE0)
+  {
+    *bits = c & 0x0F;
+    *min = 0x800;
+    return 3;
+  }
+  if ((c & 0xF8) == 0xF0)
+  {
+    *bits = c & 0x07;
+    *min = 0x10000;
+    return 4;
+  }
+  return 0;
+}
+
+bool valid_utf8 (const char *begin, const char *end)
+{
+  const unsigned char *cur = (const unsigned char *) begin;
+  const unsigned char *stop = (const unsigned char *) end;
+  while (cur < stop)
+  {
+#ifdef TOKENIZER_SIMD
+    if (stop - cur >= TOKENIZER_SIMD && vec_mask (vec_load (cur)) == 0)
+    {
+      cur += TOKENIZER_SIMD; // all ASCII
+      continue;
+    }
+#endif
+    uint32_t code = 0, min = 0;
+    int len = sequence_length (*cur, &code, &min);
+    if (len == 0 || stop - cur < len)
+    {
+      return false;
+    }
+    for (int i = 1; i < len; i++)
+    {
+      if ((cur[i] & 0xC0) != 0x80)
+      {
+        return false;
+      }
+      code = (code << 6) | (cur[i] & 0x3F);
+    }
+    if (code < min || code > UTF8_MAX
+        || (code >= SURROGATE_FIRST && code <= SURROGATE_LAST))
+    {
+      return false;
+    }
+    cur += len;
+  }
+  return true;
+}
+
+/**
+ * lowercases the ASCII letters of a range in place. A block of
+ * TOKENIZER_SIMD bytes is written back whole if it holds an uppercase
+ * letter and left untouched otherwise; the bytes past the last block are
+ * written only if they change.
+ * @param cur start of the range
+ * @param end end of the range
+ */
+static void lowercase (char *cur, char *end)
+{
+#ifdef TOKENIZER_SIMD
+  for (; end - cur >= TOKENIZER_SIMD; cur += TOKENIZER_SIMD)
+  {
+    Vec v = vec_load (cur);
+    Vec upper = vec_in_range (v, 'A', 'Z' - 'A');
+    if (vec_mask (upper) != 0)
+    {
+      vec_store (cur, vec_add (v, vec_and (upper, vec_set (ASCII_CASE_BIT))));
+    }
+  }
+#endif
+  for (; cur < end; cur++)
+  {
+    if (*cur >= 'A' && *cur <= 'Z')
+    {
+      *cur = (char) (*cur | ASCII_CASE_BIT);
+    }
+  }
+}
+
+char *next_token (char **pos, char *end, int flags)
+{
+  char *cur = *pos;
+  while (true)
+  {
+    cur = (char *) skip_delims (cur, end);
+    if (cur == end)
+    {
+      *pos = cur;
+      return NULL;
+    }
+    char *token = cur;
+    cur = (char *) skip_token (cur, end);
+    if ((flags & TOKEN_VALIDATE_UTF8) && valid_utf8 (token, cur) == false)
+    {
+      continue;
+    }
+    if (flags & TOKEN_LOWERCASE)
+    {
+      lowercase (token, cur);
+    }
+    *pos = cur;
+    return token;
+  }
+}
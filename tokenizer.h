@@ -0,0 +1,66 @@
+#ifndef _TOKENIZER_H_
+#define _TOKENIZER_H_
+#include <stdlib.h> // For size_t
+#include <stdbool.h> // for bool
+
+// flags of next_token
+#define TOKEN_LOWERCASE 1 // lowercase the ASCII letters of tokens in place
+#define TOKEN_VALIDATE_UTF8 2 // skip tokens that aren't valid UTF-8
+
+/**
+ * Checks if a character separates tokens. Defined here so that word_length
+ * and word_cmp, which the chain of words hashes and compares with, don't
+ * call out for every character.
+ * @param c character
+ * @return true if c is ASCII whitespace (space, \t, \n, \v, \f, \r) or a
+ * null terminator
+ */
+static inline bool is_token_delim (char c)
+{
+  unsigned char u = (unsigned char) c;
+  return u == ' ' || (u >= '\t' && u <= '\r') || u == '\0';
+}
+
+/**
+ * Finds the first delimiter in [cur, end), 16 or 32 bytes at a time with
+ * SSE2 or AVX2 when the compiler targets them (see TOKENIZER_SIMD).
+ * @param cur start of the range
+ * @param end end of the range
+ * @return the first delimiter, end if there is none
+ */
+const char *skip_token (const char *cur, const char *end);
+
+/**
+ * Finds the first character in [cur, end) that is not a delimiter, like
+ * skip_token.
+ * @param cur start of the range
+ * @param end end of the range
+ * @return the first non delimiter, end if there is none
+ */
+const char *skip_delims (const char *cur, const char *end);
+
+/**
+ * Checks that bytes are well formed UTF-8: no stray continuation bytes,
+ * truncated, overlong or surrogate sequences, or code points above
+ * U+10FFFF.
+ * @param begin first byte
+ * @param end end of the bytes
+ * @return true if they are valid UTF-8
+ */
+bool valid_utf8 (const char *begin, const char *end);
+
+/**
+ * Finds the next token in [*pos, end) and moves *pos past it. Keeps no
+ * state besides *pos, so any number of threads may tokenize at once. With
+ * TOKEN_LOWERCASE the token is lowercased in place, so the bytes must be
+ * writable, and with TOKEN_VALIDATE_UTF8 tokens that aren't valid UTF-8 are
+ * skipped. Both are done while the token is in cache, and doing them again
+ * on the same bytes gives the same tokens.
+ * @param pos current position
+ * @param end end of the range, the token ends at a delimiter or at end
+ * @param flags TOKEN_ flags, or 0
+ * @return start of the token, NULL if there are no more tokens
+ */
+char *next_token (char **pos, char *end, int flags);
+
+#endif //_TOKENIZER_H_
@@ -1,23 +1,69 @@
 #include "linked_list.h"
 #include "markov_chain.h"
+#include "corpus.h"
+#include "writer.h"
+#include "stats.h"
 
 #include <stdio.h>  // For printf(), sscanf()
 #include <stdlib.h> // For exit(), malloc()
 #include <stdbool.h> // for bool
 #include <string.h>
 
-#define USG_ERR "Usage: argument number must be 3 or 4."
+#define USG_ERR "Usage: tweets_generator <seed> <tweet number> \
+<corpus path | -> [words to read] [options]\n\
+       tweets_generator <seed> <tweet number> --load <path> [options]\n\
+Options: --threads N, --save PATH, --load PATH, --trace PATH, --order K,\n\
+         --decay PERCENT, --min-count N, --max-successors N,\n\
+         --prune-every N, --batch, --json, --stats, --lowercase, --utf8,\n\
+         --compact, --weighted-starts\n"
 #define ERR_MSG "Error: Given path is corrupted or unreachable."
 
 #define TWEET "Tweet "
 #define MAX_WORDS 20
-#define MAX_TWEET 1000
-#define DELIM "\n "
 #define DOT_ASCII 46
-#define MAX_WORD_LENGTH 100
+#define FNV_OFFSET 14695981039346656037UL
+#define FNV_PRIME 1099511628211UL
 
 #define MIN_ARGS 4
 #define MAX_ARGS 5
+#define WEIGHTED_STARTS_FLAG "--weighted-starts"
+#define THREADS_FLAG "--threads"
+#define STDIN_PATH "-"
+#define SAVE_FLAG "--save"
+#define LOAD_FLAG "--load"
+#define LOAD_ARGS 3
+#define BATCH_FLAG "--batch"
+#define BATCH_SIZE 65536
+#define JSON_FLAG "--json"
+#define ORDER_FLAG "--order"
+#define DECAY_FLAG "--decay"
+#define STATS_FLAG "--stats"
+#define TRACE_FLAG "--trace"
+#define LOWERCASE_FLAG "--lowercase"
+#define UTF8_FLAG "--utf8"
+#define COMPACT_FLAG "--compact"
+#define MIN_COUNT_FLAG "--min-count"
+#define MAX_SUCCESSORS_FLAG "--max-successors"
+#define PRUNE_EVERY_FLAG "--prune-every"
+#define FULL_PERCENT 100
+#define VOCAB_SUFFIX ".vocab"
+#define JSON_TWEET_START "{\"index\":"
+#define JSON_TEXT_START ",\"text\":\""
+#define JSON_TWEET_END "\"}\n"
+#define PATH_ERR "Error: --save, --load and --trace must be followed by a \
+path.\n"
+#define TRACE_ERR "Error: Failed to write the trace file.\n"
+#define NO_START_ERR "Error: No word of the corpus can start a tweet.\n"
+#define SNAPSHOT_ERR "Error: Failed to read or write the snapshot file.\n"
+#define ORDER_ERR "Error: --order must be followed by a number between 1 and \
+8.\n"
+#define DECAY_ERR "Error: --decay must be followed by a percentage between 0 \
+and 100.\n"
+#define THREADS_ERR "Error: --threads must be followed by a number between \
+1 and 256.\n"
+#define PRUNE_ERR "Error: --min-count, --max-successors and --prune-every \
+must be followed by a positive number.\n"
+#define PRUNE_REPORT "Pruning reclaimed %zu bytes.\n"
 
 typedef struct NeededValues
 {
@@ -25,93 +71,238 @@ typedef struct NeededValues
     int tweet_num;
     int read_num;
     FILE *fp;
+    bool weight_starts;
+    int thread_num;
+    char *save_path; // snapshot to write after training, or NULL
+    char *load_path; // snapshot to generate from instead of a corpus, or NULL
+    bool batch;
+    bool json;
+    int order; // number of words in a state
+    int decay; // percentage of the counts of a loaded chain to keep
+    bool stats;
+    char *trace_path; // Chrome trace of the phases to write, or NULL
+    int token_flags; // TOKEN_ flags to read the corpus with
+    bool compact; // generate from a compacted chain
+    int min_count; // minimal frequency of the edges kept, 0 not to prune
+    int max_successors; // most successors a state keeps, 0 for no maximum
+    // edges trained between the passes dropping the edges below min_count
+    // while training, 0 to prune only once training is done
+    int prune_every;
 } NeededValues;
 
+#define NO_VALUES {.thread_num = 1, .order = 1, .decay = FULL_PERCENT}
+
+/**
+ * where str_print writes the tweets to. print_func gets nothing but the
+ * node, so main sets these up before generating.
+ */
+static Writer *output = NULL;
+static bool json_output = false;
+static bool tweet_open = false; // the current tweet's last word is not out
+
+/**
+ * chain of the words of an order k chain, the words by id, and whether the
+ * next state printed starts a tweet, in which case all of its words are
+ * printed
+ */
+static MarkovChain *vocab = NULL;
+static const char **words = NULL;
+static bool tweet_start = false;
+
 /**
  * fills database
  * @param fp File to read tweets from
  * @param markov_chain markov chain
  * @param words_to_read number of words to read from the file
+ * @param thread_num number of threads to train with
+ * @param token_flags TOKEN_ flags to read the words with
+ * @param order number of words in a state, above 1 the chain is of
+ * n-grams and its words go to vocab
  * @return EXIT_SUCCESS or EXIT_FAILURE
  */
-static int
-fill_database (FILE *fp, int words_to_read, MarkovChain *markov_chain)
+static int fill_database (FILE *fp, int words_to_read, int thread_num,
+                          int token_flags, int order,
+                          MarkovChain *markov_chain)
 {
-  char str[MAX_TWEET];
-  MarkovNode *temp = NULL;
-  char *word = NULL;
-  char *k = fgets (str, MAX_TWEET, fp);
-  while (k != NULL && words_to_read != 0)
+  if (order > 1)
   {
-    while (words_to_read != 0)
-    {
-      word = strtok (word == NULL ? str : NULL, DELIM);
-      if (word == NULL)
-      {
-        break;
-      }
-      Node *new = add_to_database (markov_chain, word);
-      if (new == NULL)
-      {
-        fclose (fp);
-        free_markov_chain (&markov_chain);
-        return EXIT_FAILURE;
-      }
-      if (temp != NULL)
-      {
-        int i = add_node_to_counter_list (temp, new->data, markov_chain);
-        if (i == false)
-        {
-          fclose (fp);
-          free_markov_chain (&markov_chain);
-          return EXIT_FAILURE;
-        }
-      }
-      temp = new->data;
-      words_to_read--;
-    }
-    k = fgets (str, MAX_TWEET, fp);
+    return train_ngrams_on_file (fp, words_to_read, order, thread_num,
+                                 token_flags, vocab, markov_chain);
   }
-  return EXIT_SUCCESS;
+  return train_on_file (fp, words_to_read, thread_num, token_flags,
+                        markov_chain);
 }
 
 /**
- * handles user input
+ * handles user input. Flags may appear anywhere among the arguments.
  * @param argc number of arguments
- * @param argv arguments
+ * @param argv arguments: seed, number of tweets, path to corpus ("-" for
+ * stdin) and
+ * optionally number of words to read, and the optional flags
+ * --weighted-starts to start tweets the way corpus sentences start and
+ * --threads N to train on the corpus (and with --batch, generate tweets)
+ * with N threads, --batch to give every tweet its own random stream so the
+ * output doesn't depend on the number of threads, --json to print every
+ * tweet as a JSON object {"index":N,"text":"..."} on its own line, --order K
+ * to make every state the last K words instead of one, --save PATH to write
+ * the trained chain to a snapshot (and with --order, its words to
+ * PATH.vocab) and --load PATH to generate from a
+ * snapshot, in which case the corpus and number of words may be left out,
+ * or given to train the loaded chain further, and --decay P to keep only P
+ * percent of the loaded counts before that, forgetting what drops to 0,
+ * --stats to print where the time went and the shape of the chain to
+ * stderr, --trace PATH to write the phases as a Chrome trace, --lowercase
+ * to lowercase the words of the corpus, --utf8 to skip its words that
+ * aren't valid UTF-8, --compact to generate from a compacted chain, which
+ * takes less memory but draws different tweets for a given seed, and
+ * --min-count N and --max-successors K to prune the edges seen fewer than N
+ * times and keep the K most frequent successors of every state once
+ * training is done (counts are exact until then), before saving, printing
+ * the bytes reclaimed to stderr, and --prune-every E to also drop the edges
+ * seen fewer than N times so far every E edges while training, which
+ * bounds the memory training takes at the cost of exact counts
  * @return struct containing loaded data if successful, empty struct otherwise
  */
 static NeededValues handle_input (int argc, char **argv)
 {
-  if (argc == MIN_ARGS || argc == MAX_ARGS)
+  NeededValues ret = NO_VALUES;
+  char *args[MAX_ARGS];
+  int arg_num = 0;
+  for (int i = 0; i < argc; i++)
+  {
+    if (strcmp (argv[i], WEIGHTED_STARTS_FLAG) == 0)
+    {
+      ret.weight_starts = true;
+    }
+    else if (strcmp (argv[i], BATCH_FLAG) == 0)
+    {
+      ret.batch = true;
+    }
+    else if (strcmp (argv[i], JSON_FLAG) == 0)
+    {
+      ret.json = true;
+    }
+    else if (strcmp (argv[i], STATS_FLAG) == 0)
+    {
+      ret.stats = true;
+    }
+    else if (strcmp (argv[i], COMPACT_FLAG) == 0)
+    {
+      ret.compact = true;
+    }
+    else if (strcmp (argv[i], LOWERCASE_FLAG) == 0)
+    {
+      ret.token_flags |= TOKEN_LOWERCASE;
+    }
+    else if (strcmp (argv[i], UTF8_FLAG) == 0)
+    {
+      ret.token_flags |= TOKEN_VALIDATE_UTF8;
+    }
+    else if (strcmp (argv[i], ORDER_FLAG) == 0)
+    {
+      if (i + 1 == argc || sscanf (argv[++i], "%d", &ret.order) != 1
+          || ret.order < 1 || ret.order > MAX_ORDER)
+      {
+        printf (ORDER_ERR);
+        return (NeededValues) NO_VALUES;
+      }
+    }
+    else if (strcmp (argv[i], DECAY_FLAG) == 0)
+    {
+      if (i + 1 == argc || sscanf (argv[++i], "%d", &ret.decay) != 1
+          || ret.decay < 0 || ret.decay > FULL_PERCENT)
+      {
+        printf (DECAY_ERR);
+        return (NeededValues) NO_VALUES;
+      }
+    }
+    else if (strcmp (argv[i], MIN_COUNT_FLAG) == 0
+             || strcmp (argv[i], MAX_SUCCESSORS_FLAG) == 0
+             || strcmp (argv[i], PRUNE_EVERY_FLAG) == 0)
+    {
+      int *value = strcmp (argv[i], MIN_COUNT_FLAG) == 0 ? &ret.min_count
+                   : strcmp (argv[i], MAX_SUCCESSORS_FLAG) == 0
+                     ? &ret.max_successors : &ret.prune_every;
+      if (i + 1 == argc || sscanf (argv[++i], "%d", value) != 1 || *value < 1)
+      {
+        printf (PRUNE_ERR);
+        return (NeededValues) NO_VALUES;
+      }
+    }
+    else if (strcmp (argv[i], THREADS_FLAG) == 0)
+    {
+      if (i + 1 == argc || sscanf (argv[++i], "%d", &ret.thread_num) != 1
+          || ret.thread_num < 1 || ret.thread_num > MAX_THREADS)
+      {
+        printf (THREADS_ERR);
+        return (NeededValues) NO_VALUES;
+      }
+    }
+    else if (strcmp (argv[i], SAVE_FLAG) == 0
+             || strcmp (argv[i], LOAD_FLAG) == 0
+             || strcmp (argv[i], TRACE_FLAG) == 0)
+    {
+      if (i + 1 == argc)
+      {
+        printf (PATH_ERR);
+        return (NeededValues) NO_VALUES;
+      }
+      if (strcmp (argv[i], SAVE_FLAG) == 0)
+      {
+        ret.save_path = argv[++i];
+      }
+      else if (strcmp (argv[i], TRACE_FLAG) == 0)
+      {
+        ret.trace_path = argv[++i];
+      }
+      else
+      {
+        ret.load_path = argv[++i];
+      }
+    }
+    else if (arg_num++ < MAX_ARGS)
+    {
+      args[arg_num - 1] = argv[i];
+    }
+  }
+  if (ret.load_path != NULL && arg_num == LOAD_ARGS)
+  {
+    sscanf (args[1], "%d", &ret.seed);
+    sscanf (args[2], "%d", &ret.tweet_num);
+    return ret;
+  }
+  if (arg_num == MIN_ARGS || arg_num == MAX_ARGS)
   {
     int read_num, seed, tweet_num;
-    sscanf (argv[1], "%d", &seed);
-    sscanf (argv[2], "%d", &tweet_num);
-    char *path = argv[3];
-    if (argc == MAX_ARGS)
+    sscanf (args[1], "%d", &seed);
+    sscanf (args[2], "%d", &tweet_num);
+    char *path = args[3];
+    if (arg_num == MAX_ARGS)
     {
-      sscanf (argv[4], "%d", &read_num);
+      sscanf (args[4], "%d", &read_num);
     }
     else
     {
       read_num = -1;
     }
-    FILE *fp = fopen (path, "r");
+    FILE *fp = strcmp (path, STDIN_PATH) == 0 ? stdin : fopen (path, "r");
     if (fp == NULL)
     {
       printf (ERR_MSG);
-      NeededValues ret = {0, 0, 0, NULL};
+      ret.save_path = NULL;
+      ret.load_path = NULL;
       return ret;
     }
-    NeededValues ret = {seed, tweet_num, read_num, fp};
+    ret.seed = seed;
+    ret.tweet_num = tweet_num;
+    ret.read_num = read_num;
+    ret.fp = fp;
     return ret;
   }
   else
   {
     printf (USG_ERR);
-    NeededValues ret = {0, 0, 0, NULL};
-    return ret;
+    return (NeededValues) NO_VALUES;
   }
 }
 
@@ -125,6 +316,17 @@ static void str_free (void *str_p)
   free (node->data);
 }
 
+/**
+ * Checks if a word ends a sentence
+ * @param str word
+ * @return true if there is a dot at its end, false otherwise
+ */
+static bool ends_sentence (const char *str)
+{
+  size_t t = word_length (str);
+  return *(str + t - 1) == DOT_ASCII;
+}
+
 /**
  * Checks if there's a dot at the end of a string
  * @param str string
@@ -133,33 +335,114 @@ static void str_free (void *str_p)
 static bool dot_at_end (const void *str_p)
 {
   MarkovNode *cur = (MarkovNode *) str_p;
-  char *str = cur->data;
-  unsigned long t = strlen (str);
-  char comp = *(str + t - 1);
-  if (comp == DOT_ASCII || cur->is_last)
-  {
-    return true;
-  }
-  return false;
+  return ends_sentence (cur->data) || cur->is_last;
+}
+
+/**
+ * Checks if the last word of an n-gram ends a sentence
+ * @param ngram_p pointer to node containing the n-gram
+ * @return true if there is a dot at its end, false otherwise
+ */
+static bool ngram_at_end (const void *ngram_p)
+{
+  MarkovNode *cur = (MarkovNode *) ngram_p;
+  return ends_sentence (words[ngram_last (cur->data)]) || cur->is_last;
 }
 
 /**
- * copies a string
- * @param str_data data to copy
+ * copies a word into a null terminated string
+ * @param str_data word to copy
  * @return the copied string
  */
 static void *str_copy (const void *str_data)
 {
   char *str = (char *) str_data;
-  void *ret = malloc (MAX_WORD_LENGTH);
+  size_t len = word_length (str);
+  char *ret = malloc (len + 1);
   if (ret == NULL)
   {
     return NULL;
   }
-  strcpy (ret, str);
+  memcpy (ret, str, len);
+  ret[len] = '\0';
   return ret;
 }
 
+/**
+ * returns the size of a word, including the delimiter that ends it
+ * @param str_data word
+ * @return number of bytes the word takes
+ */
+static size_t str_size (const void *str_data)
+{
+  return word_length ((const char *) str_data) + 1;
+}
+
+/**
+ * writes the start of a tweet: "Tweet <i>: " as text, and in JSON the
+ * object {"index":<i>,"text":" up to the opening quote of its text
+ * @param i number of the tweet
+ */
+static void start_tweet (int i)
+{
+  if (json_output)
+  {
+    writer_bytes (output, JSON_TWEET_START, strlen (JSON_TWEET_START));
+    writer_int (output, i);
+    writer_bytes (output, JSON_TEXT_START, strlen (JSON_TEXT_START));
+  }
+  else
+  {
+    writer_bytes (output, TWEET, strlen (TWEET));
+    writer_int (output, i);
+    writer_bytes (output, ": ", 2);
+  }
+  tweet_open = true;
+  tweet_start = true;
+}
+
+/**
+ * closes the JSON object of a tweet that ended without a last word, which
+ * happens when its last word was never followed by another in the corpus
+ */
+static void end_tweet (void)
+{
+  if (json_output && tweet_open)
+  {
+    writer_bytes (output, JSON_TWEET_END, strlen (JSON_TWEET_END));
+  }
+  tweet_open = false;
+}
+
+/**
+ * prints a word of a tweet, followed by a space or, for its last word, by
+ * the end of the tweet
+ * @param str word
+ * @param last whether the word ends the tweet
+ */
+static void print_word (const char *str, bool last)
+{
+  size_t len = word_length (str);
+  if (json_output)
+  {
+    writer_json (output, str, len);
+  }
+  else
+  {
+    writer_bytes (output, str, len);
+  }
+  if (last)
+  {
+    tweet_open = false;
+    if (json_output)
+    {
+      writer_bytes (output, JSON_TWEET_END, strlen (JSON_TWEET_END));
+      return;
+    }
+  }
+  writer_bytes (output, last ? "\n" : " ", 1);
+}
+
 /**
  * prints the string in given format
  * @param str_p pointer to node containing string
@@ -167,40 +450,61 @@ static void *str_copy (const void *str_data)
 static void str_print (const void *str_p)
 {
   MarkovNode *cur = (MarkovNode *) str_p;
-  char *str = cur->data;
-  if (dot_at_end (cur))
+  print_word (cur->data, dot_at_end (cur));
+}
+
+/**
+ * prints the last word of an n-gram, or all of its words if it starts the
+ * tweet
+ * @param ngram_p pointer to node containing the n-gram
+ */
+static void ngram_print (const void *ngram_p)
+{
+  MarkovNode *cur = (MarkovNode *) ngram_p;
+  const uint32_t *ngram = cur->data;
+  if (tweet_start)
   {
-    printf ("%s\n", str);
-    return;
+    for (uint32_t i = 1; i < ngram[0]; i++)
+    {
+      print_word (words[ngram[i]], false);
+    }
+    tweet_start = false;
   }
-  printf ("%s ", str);
+  print_word (words[ngram_last (ngram)], ngram_at_end (cur));
 }
 
 /**
- * compares two strings
- * @param a first string
- * @param b secong string
+ * compares two words
+ * @param a first word
+ * @param b secong word
  * @return 0 if the same, the difference in their ASCII otherwise
  */
 static int str_cmp (const void *a, const void *b)
 {
   const char *str1 = (char *) a, *str2 = (char *) b;
-  return strcmp (str1, str2);
+  return word_cmp (str1, str2);
 }
 
 /**
- * fills the chain with needed functions
- * @param markov_chain markov chain to be filled
+ * hashes a word (FNV-1a)
+ * @param str_data word to hash
+ * @return hash of the word
  */
-static void set_chain (MarkovChain *markov_chain)
+static unsigned long str_hash (const void *str_data)
 {
-  markov_chain->free_data = str_free;
-  markov_chain->copy_func = str_copy;
-  markov_chain->print_func = str_print;
-  markov_chain->comp_func = str_cmp;
-  markov_chain->is_last = dot_at_end;
+  const unsigned char *str = (const unsigned char *) str_data;
+  size_t len = word_length (str_data);
+  unsigned long hash = FNV_OFFSET;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= str[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
 }
 
+static MARKOV_DEFINE_LOOKUP (str_lookup, str_hash, str_cmp)
+
 /**
  * initiates linked list
  * @return initiated linked list
@@ -219,46 +523,399 @@ LinkedList *init_linked (void)
   return linked;
 }
 
+/**
+ * fills the chain with needed functions
+ * @param markov_chain markov chain to be filled
+ */
+static void set_chain (MarkovChain *markov_chain)
+{
+  markov_chain->free_data = str_free;
+  markov_chain->copy_func = str_copy;
+  markov_chain->print_func = str_print;
+  markov_chain->comp_func = str_cmp;
+  markov_chain->is_last = dot_at_end;
+  markov_chain->hash_func = str_hash;
+  markov_chain->lookup_func = str_lookup;
+  markov_chain->data_size = str_size;
+}
+
+/**
+ * fills a chain of n-grams with needed functions. The n-grams are stored
+ * by the chain, so it needs no copy_func or free_data.
+ * @param markov_chain markov chain to be filled
+ */
+static void set_ngram_chain (MarkovChain *markov_chain)
+{
+  markov_chain->print_func = ngram_print;
+  markov_chain->comp_func = ngram_cmp;
+  markov_chain->is_last = ngram_at_end;
+  markov_chain->hash_func = ngram_hash;
+  markov_chain->lookup_func = ngram_lookup;
+  markov_chain->data_size = ngram_size;
+}
+
+/**
+ * allocates an empty chain
+ * @param ngrams whether the chain is of n-grams or of words
+ * @return the chain, NULL on allocation failure
+ */
+static MarkovChain *new_chain (bool ngrams)
+{
+  MarkovChain *chain = calloc (1, sizeof (*chain));
+  if (chain == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return NULL;
+  }
+  chain->database = init_linked ();
+  if (chain->database == NULL)
+  {
+    free (chain);
+    return NULL;
+  }
+  if (ngrams)
+  {
+    set_ngram_chain (chain);
+  }
+  else
+  {
+    set_chain (chain);
+  }
+  return chain;
+}
+
+/**
+ * collects the words of the vocabulary of an n-gram chain by id
+ * @return true on success, false on allocation failure
+ */
+static bool collect_words (void)
+{
+  words = malloc ((vocab->database->size + 1) * sizeof (char *));
+  if (words == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  for (Node *cur = vocab->database->first; cur != NULL; cur = cur->next)
+  {
+    words[cur->data->id] = cur->data->data;
+  }
+  return true;
+}
+
+/**
+ * checks that the states of a loaded chain are n-grams of the given order
+ * over the loaded vocabulary
+ * @param markov_chain loaded chain of n-grams
+ * @param order expected order
+ * @return true if they are, false otherwise
+ */
+static bool check_ngrams (MarkovChain *markov_chain, int order)
+{
+  for (Node *cur = markov_chain->database->first; cur != NULL; cur = cur->next)
+  {
+    const uint32_t *ngram = cur->data->data;
+    if (ngram[0] != (uint32_t) order)
+    {
+      return false;
+    }
+    for (int i = 1; i <= order; i++)
+    {
+      if (ngram[i] >= (uint32_t) vocab->database->size)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * builds the path of the vocabulary snapshot that goes with a snapshot
+ * @param path path of the snapshot
+ * @return PATH.vocab, NULL on allocation failure
+ */
+static char *vocab_path (const char *path)
+{
+  char *ret = malloc (strlen (path) + strlen (VOCAB_SUFFIX) + 1);
+  if (ret == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    return NULL;
+  }
+  strcpy (ret, path);
+  strcat (ret, VOCAB_SUFFIX);
+  return ret;
+}
+
+/**
+ * writes the chain to a snapshot, and the vocabulary of an n-gram chain to
+ * the snapshot's PATH.vocab
+ * @param markov_chain chain to save
+ * @param path path of the snapshot
+ * @return true on success, false otherwise
+ */
+static bool save_chain (MarkovChain *markov_chain, const char *path)
+{
+  if (vocab == NULL)
+  {
+    return save_markov_chain (markov_chain, path);
+  }
+  char *path_vocab = vocab_path (path);
+  bool suc = path_vocab != NULL && save_markov_chain (markov_chain, path)
+             && save_markov_chain (vocab, path_vocab);
+  free (path_vocab);
+  return suc;
+}
+
+/**
+ * loads a chain saved by save_chain
+ * @param markov_chain empty chain to load into
+ * @param path path of the snapshot
+ * @param order order the chain was trained with
+ * @return true on success, false otherwise
+ */
+static bool load_chain (MarkovChain *markov_chain, const char *path, int order)
+{
+  if (vocab == NULL)
+  {
+    return load_markov_chain (markov_chain, path);
+  }
+  char *path_vocab = vocab_path (path);
+  bool suc = path_vocab != NULL && load_markov_chain (vocab, path_vocab)
+             && load_markov_chain (markov_chain, path)
+             && check_ngrams (markov_chain, order);
+  free (path_vocab);
+  return suc;
+}
+
+/**
+ * generates and prints the tweets BATCH_SIZE at a time with generate_batch
+ * @param chain frozen chain
+ * @param seed seed
+ * @param tweet_num number of tweets
+ * @param thread_num number of threads
+ * @param max_length maximum number of states in a tweet
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int print_batches (MarkovChain *chain, int seed, int tweet_num,
+                          int thread_num, int max_length)
+{
+  MarkovNode **tweets = malloc (BATCH_SIZE * max_length
+                                * sizeof (MarkovNode *));
+  int *lengths = malloc (BATCH_SIZE * sizeof (int));
+  if (tweets == NULL || lengths == NULL)
+  {
+    printf (ALLOCATION_ERROR_MASSAGE);
+    free (tweets);
+    free (lengths);
+    return EXIT_FAILURE;
+  }
+  for (int first = 0; first < tweet_num; first += BATCH_SIZE)
+  {
+    int num = tweet_num - first < BATCH_SIZE ? tweet_num - first : BATCH_SIZE;
+    generate_batch (chain, (uint64_t) seed, first, num, max_length,
+                    thread_num, tweets, lengths);
+    for (int i = 0; i < num; i++)
+    {
+      start_tweet (first + i + 1);
+      print_sequence (chain, tweets + (size_t) i * max_length, lengths[i],
+                      max_length);
+      end_tweet ();
+    }
+  }
+  free (tweets);
+  free (lengths);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * frees what main allocated before failing
+ * @param markov_chain chain to free, or NULL
+ * @param fp corpus file to close, or NULL
+ * @return EXIT_FAILURE
+ */
+static int exit_failure (MarkovChain **markov_chain, FILE *fp)
+{
+  if (markov_chain != NULL)
+  {
+    free_markov_chain (markov_chain);
+  }
+  if (vocab != NULL)
+  {
+    free_markov_chain (&vocab);
+  }
+  free (words);
+  if (fp != NULL)
+  {
+    fclose (fp);
+  }
+  return EXIT_FAILURE;
+}
+
+/**
+ * prints the stats and writes the trace, if asked to
+ * @param stats whether to print the stats to stderr
+ * @param trace_path path of the trace to write, or NULL
+ * @return EXIT_SUCCESS or EXIT_FAILURE if the trace couldn't be written
+ */
+static int report_stats (bool stats, const char *trace_path)
+{
+  if (stats)
+  {
+    print_stats (stderr);
+  }
+  if (trace_path != NULL && write_trace (trace_path) == false)
+  {
+    printf (TRACE_ERR);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
 int main (int argc, char **argv)
 {
   NeededValues input = handle_input (argc, argv);
-  if (input.fp == NULL)
+  if (input.fp == NULL && input.load_path == NULL)
   {
     return EXIT_FAILURE;
   }
   int read_num = input.read_num, tweet_num = input.tweet_num,seed = input.seed;
   FILE *fp = input.fp;
-  MarkovChain *chain = malloc (sizeof (*chain));
+  if (input.stats || input.trace_path != NULL)
+  {
+    stats_enable ();
+  }
+  int order = input.order, max_length = MAX_WORDS - order + 1;
+  if (order > 1 && (vocab = new_chain (false)) == NULL)
+  {
+    return exit_failure (NULL, fp);
+  }
+  MarkovChain *chain = new_chain (order > 1);
   if (chain == NULL)
+  {
+    return exit_failure (NULL, fp);
+  }
+  chain->weight_starts = input.weight_starts;
+  if (input.prune_every > 0)
+  {
+    chain->prune_below = input.min_count;
+    chain->prune_interval = input.prune_every;
+  }
+  bool suc = true;
+  if (input.load_path != NULL)
+  {
+    stats_begin ("ingest");
+    suc = load_chain (chain, input.load_path, order);
+    stats_end ();
+  }
+  if (suc == false)
+  {
+    printf (SNAPSHOT_ERR);
+    return exit_failure (&chain, fp);
+  }
+  if (input.decay != FULL_PERCENT)
+  {
+    stats_begin ("decay");
+    suc = decay_markov_chain (chain, input.decay, FULL_PERCENT);
+    stats_end ();
+  }
+  if (suc == false)
+  {
+    return exit_failure (&chain, fp);
+  }
+  if (fp != NULL && fill_database (fp, read_num, input.thread_num,
+                                   input.token_flags, order, chain)
+                    == EXIT_FAILURE)
+  {
+    return exit_failure (&chain, fp);
+  }
+  if (input.min_count > 0 || input.max_successors > 0)
+  {
+    size_t reclaimed = 0;
+    stats_begin ("prune");
+    suc = prune_markov_chain (chain, input.min_count, input.max_successors,
+                              &reclaimed);
+    stats_end ();
+    fprintf (stderr, PRUNE_REPORT, reclaimed);
+  }
+  if (suc == false)
+  {
+    return exit_failure (&chain, fp);
+  }
+  if (input.save_path != NULL)
+  {
+    stats_begin ("save");
+    suc = save_chain (chain, input.save_path);
+    stats_end ();
+  }
+  if (suc == false)
+  {
+    printf (SNAPSHOT_ERR);
+    return exit_failure (&chain, fp);
+  }
+  stats_begin ("freeze");
+  suc = (vocab == NULL || collect_words ())
+        && (input.compact ? compact_markov_chain (chain)
+                          : freeze_markov_chain (chain));
+  stats_end ();
+  if (suc == false)
+  {
+    return exit_failure (&chain, fp);
+  }
+  if (tweet_num > 0 && has_start_state (chain) == false)
+  {
+    printf (NO_START_ERR);
+    return exit_failure (&chain, fp);
+  }
+  fflush (stdout);
+  output = new_writer (stdout, WRITER_CAPACITY);
+  if (output == NULL)
   {
     printf (ALLOCATION_ERROR_MASSAGE);
-    fclose (fp);
-    return EXIT_FAILURE;
+    return exit_failure (&chain, fp);
   }
-  LinkedList *linked = init_linked ();
-  if (linked == NULL)
+  json_output = input.json;
+  stats_begin ("generation");
+  if (input.batch)
   {
-    fclose (fp);
-    free (chain);
-    return EXIT_FAILURE;
+    if (print_batches (chain, seed, tweet_num, input.thread_num, max_length)
+        == EXIT_FAILURE)
+    {
+      free_writer (output);
+      return exit_failure (&chain, fp);
+    }
   }
-  chain->database = linked;
-  set_chain (chain);
-  int suc = fill_database (fp, read_num, chain);
-  if (suc == EXIT_FAILURE)
+  else
   {
-    return EXIT_FAILURE;
+    srand (seed);
+    int i = 1;
+    while (tweet_num >= i)
+    {
+      start_tweet (i);
+      generate_random_sequence (chain, NULL, max_length);
+      end_tweet ();
+      i++;
+    }
   }
-  srand (seed);
-  int i = 1;
-  while (tweet_num >= i)
+  suc = free_writer (output);
+  stats_end ();
+  if (suc == false)
   {
-    printf (TWEET);
-    printf ("%d: ", i);
-    generate_random_sequence (chain, NULL, MAX_WORDS);
-    i++;
+    return exit_failure (&chain, fp);
   }
+  stats_chain (chain);
+  stats_begin ("teardown");
   free_markov_chain (&chain);
-  fclose (fp);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  if (vocab != NULL)
+  {
+    free_markov_chain (&vocab);
+  }
+  free (words);
+  if (fp != NULL)
+  {
+    fclose (fp);
+  }
+  stats_end ();
+  return report_stats (input.stats, input.trace_path);
+}
@@ -0,0 +1,125 @@
+#include "writer.h"
+#include <string.h>
+
+#define MAX_DIGITS 24
+#define HEX "0123456789abcdef"
+#define CONTROL_LIMIT 0x20
+
+Writer *new_writer (FILE *fp, size_t capacity)
+{
+  Writer *writer = malloc (sizeof (Writer));
+  if (writer == NULL)
+  {
+    return NULL;
+  }
+  writer->buf = malloc (capacity);
+  if (writer->buf == NULL)
+  {
+    free (writer);
+    return NULL;
+  }
+  writer->fp = fp;
+  writer->used = 0;
+  writer->capacity = capacity;
+  writer->failed = false;
+  return writer;
+}
+
+/**
+ * hands the buffered bytes to the file
+ * @param writer writer
+ */
+static void drain (Writer *writer)
+{
+  if (writer->used > 0
+      && fwrite (writer->buf, 1, writer->used, writer->fp) != writer->used)
+  {
+    writer->failed = true;
+  }
+  writer->used = 0;
+}
+
+void writer_bytes (Writer *writer, const char *bytes, size_t len)
+{
+  if (writer->capacity - writer->used < len)
+  {
+    drain (writer);
+    if (len >= writer->capacity)
+    {
+      if (fwrite (bytes, 1, len, writer->fp) != len)
+      {
+        writer->failed = true;
+      }
+      return;
+    }
+  }
+  memcpy (writer->buf + writer->used, bytes, len);
+  writer->used += len;
+}
+
+void writer_int (Writer *writer, long value)
+{
+  char digits[MAX_DIGITS];
+  int i = MAX_DIGITS;
+  unsigned long abs = value < 0 ? 0UL - (unsigned long) value
+                                : (unsigned long) value;
+  do
+  {
+    digits[--i] = (char) ('0' + abs % 10);
+    abs /= 10;
+  }
+  while (abs > 0);
+  if (value < 0)
+  {
+    digits[--i] = '-';
+  }
+  writer_bytes (writer, digits + i, MAX_DIGITS - i);
+}
+
+void writer_json (Writer *writer, const char *bytes, size_t len)
+{
+  size_t start = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned char c = (unsigned char) bytes[i];
+    if (c != '"' && c != '\\' && c >= CONTROL_LIMIT)
+    {
+      continue;
+    }
+    writer_bytes (writer, bytes + start, i - start);
+    start = i + 1;
+    if (c == '"' || c == '\\')
+    {
+      char escaped[] = {'\\', (char) c};
+      writer_bytes (writer, escaped, sizeof (escaped));
+    }
+    else
+    {
+      char escaped[] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf]};
+      writer_bytes (writer, escaped, sizeof (escaped));
+    }
+  }
+  writer_bytes (writer, bytes + start, len - start);
+}
+
+bool flush_writer (Writer *writer)
+{
+  drain (writer);
+  if (fflush (writer->fp) != 0)
+  {
+    writer->failed = true;
+  }
+  return writer->failed == false;
+}
+
+bool free_writer (Writer *writer)
+{
+  if (writer == NULL)
+  {
+    return true;
+  }
+  bool suc = flush_writer (writer);
+  free (writer->buf);
+  free (writer);
+  return suc;
+}
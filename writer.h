@@ -0,0 +1,66 @@
+#ifndef _WRITER_H_
+#define _WRITER_H_
+#include <stdio.h>  // For FILE
+#include <stdlib.h> // For malloc()
+#include <stdbool.h> // for bool
+
+#define WRITER_CAPACITY (1 << 20)
+
+/**
+ * Output buffer: text is formatted into one large buffer which is handed to
+ * the file in a single fwrite when full, instead of a printf per token.
+ */
+typedef struct Writer {
+    FILE *fp;
+    char *buf;
+    size_t used;
+    size_t capacity;
+    bool failed; // a write to fp failed
+} Writer;
+
+/**
+ * Allocates a writer.
+ * @param fp file to write to
+ * @param capacity size of the buffer
+ * @return pointer to the new writer, NULL on allocation failure
+ */
+Writer *new_writer (FILE *fp, size_t capacity);
+
+/**
+ * Appends bytes to the writer.
+ * @param writer writer
+ * @param bytes bytes to append
+ * @param len number of bytes
+ */
+void writer_bytes (Writer *writer, const char *bytes, size_t len);
+
+/**
+ * Appends the decimal representation of a number to the writer.
+ * @param writer writer
+ * @param value number to append
+ */
+void writer_int (Writer *writer, long value);
+
+/**
+ * Appends bytes to the writer escaped to be the contents of a JSON string.
+ * @param writer writer
+ * @param bytes bytes to append, UTF-8 text
+ * @param len number of bytes
+ */
+void writer_json (Writer *writer, const char *bytes, size_t len);
+
+/**
+ * Writes the buffered bytes to the file and flushes it.
+ * @param writer writer
+ * @return true if every write so far succeeded, false otherwise
+ */
+bool flush_writer (Writer *writer);
+
+/**
+ * Flushes and frees the writer (but doesn't close its file).
+ * @param writer writer to free, may be NULL
+ * @return true if every write succeeded, false otherwise
+ */
+bool free_writer (Writer *writer);
+
+#endif //_WRITER_H_